@@ -0,0 +1,379 @@
+// Command line access to jar archives without R. Built from jam.hpp only;
+// see the Makefile in this directory.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+
+#include "jam.hpp"
+
+using namespace jam;
+
+static const char* USAGE =
+  "Usage: jamtool COMMAND [OPTIONS] FILE...\n"
+  "\n"
+  "Commands:\n"
+  "  info FILE                        Summary of the archive, its columns and chunks\n"
+  "  head [-n ROWS] FILE              First ROWS (default 10) rows as CSV\n"
+  "  cat [-d DELIM] FILE              All rows as CSV\n"
+  "  slice --chunks LIST FILE OUT     Copy chunks in LIST (e.g. 1,3-5; 1-based)\n"
+  "  select --columns LIST FILE OUT   Copy columns in LIST (e.g. id,name)\n"
+  "  concat OUT FILE...               Concatenate archives with the same columns\n"
+  "  verify FILE                      Check chunks against their checksums\n";
+
+[[noreturn]] static void usage_error(const string& msg) {
+  std::cerr << "jamtool: " << msg << "\n\n" << USAGE;
+  exit(2);
+}
+
+// Non-negative integer; usage error on anything else
+static long parse_count(const string& x, const string& what) {
+  char* end = nullptr;
+  errno = 0;
+  long out = std::strtol(x.c_str(), &end, 10);
+  if (x.empty() || *end != '\0' || errno == ERANGE || out < 0)
+    usage_error("invalid " + what + " '" + x + "'");
+  return out;
+}
+
+static str_vec split(const string& x, char sep) {
+  str_vec out;
+  std::stringstream ss(x);
+  string el;
+  while (std::getline(ss, el, sep))
+    if (!el.empty()) out.push_back(el);
+  return out;
+}
+
+// "1,3-5" -> {0, 2, 3, 4}
+static vector<size_t> parse_ranges(const string& x) {
+  vector<size_t> out;
+  for (const auto& el : split(x, ',')) {
+    size_t dash = el.find('-');
+    long from = parse_count(el.substr(0, dash), "range");
+    long to = dash == string::npos ? from : parse_count(el.substr(dash + 1), "range");
+    if (from < 1 || to < from)
+      usage_error("invalid range '" + el + "'");
+    for (long i = from; i <= to; i++)
+      out.push_back(i - 1);
+  }
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+  return out;
+}
+
+static str_vec col_names(Reader& reader) {
+  str_vec names = reader.meta.count("names") ? reader.names() : str_vec();
+  names.resize(reader.ncols());
+  return names;
+}
+
+static string col_class(const strmap<VarColl>& col_meta, Type type) {
+  auto cls = col_meta.find("class");
+  if (cls != col_meta.end() && cls->second.el_type == STRING && cls->second.size() > 0)
+    return cls->second.str_vec_val[0];
+  switch (type) {
+   case INT:    return "integer";
+   case LONG:   return "integer64";
+   case DOUBLE: return "double";
+   case STRING: return "character";
+   default:     return Type2String(type);
+  }
+}
+
+
+/* ------------------------------------------------------ */
+/* CSV OUTPUT                                             */
+/* ------------------------------------------------------ */
+
+// Formats cells of a column, resolving factor levels and R dates
+class CellFormatter {
+
+  enum Kind { PLAIN, FACTOR, DATE, DATETIME } kind_ = PLAIN;
+  const str_vec* levels_ = nullptr;
+
+ public:
+
+  explicit CellFormatter(const strmap<VarColl>& col_meta) {
+    auto cls = col_meta.find("class");
+    if (cls == col_meta.end() || cls->second.el_type != STRING)
+      return;
+    for (const auto& c : cls->second.str_vec_val) {
+      if (c == "factor") {
+        auto lev = col_meta.find("levels");
+        if (lev != col_meta.end() && lev->second.el_type == STRING) {
+          kind_ = FACTOR;
+          levels_ = &lev->second.str_vec_val;
+        }
+      } else if (c == "Date") {
+        kind_ = DATE;
+      } else if (c == "POSIXct") {
+        kind_ = DATETIME;
+      }
+    }
+  }
+
+  // Elements of list cells are separated by semicolons
+  string format(const VarColl& col, size_t i, char delim) const {
+    if (col.coll_type != LIST)
+      return format_value(col, i, delim);
+    string out;
+    for (ulong j = col.offsets[i]; j < col.offsets[i + 1]; j++)
+      out += (j > col.offsets[i] ? ";" : "") + format_value(col, j, delim);
+    return quote(out, delim);
+  }
+
+  // Element `i` of the (flat) values of `col`
+  string format_value(const VarColl& col, size_t i, char delim) const {
+    switch (col.el_type) {
+     case INT: {
+       int x = col.int_vec_val[i];
+       if (x == NA_INT) return "NA";
+       if (kind_ == FACTOR && x >= 1 && (size_t) x <= levels_->size())
+         return quote((*levels_)[x - 1], delim);
+       if (kind_ == DATE) return format_time(x * 86400.0, "%Y-%m-%d");
+       return std::to_string(x);
+     }
+     case LONG: {
+       int64_t x = col.long_vec_val[i];
+       return x == NA_LONG ? "NA" : std::to_string(x);
+     }
+     case DOUBLE: {
+       double x = col.dbl_vec_val[i];
+       if (std::isnan(x)) return "NA";
+       if (kind_ == DATE) return format_time(std::floor(x) * 86400.0, "%Y-%m-%d");
+       if (kind_ == DATETIME) return format_time(x, "%Y-%m-%dT%H:%M:%SZ");
+       char buf[32];
+       snprintf(buf, sizeof(buf), "%.15g", x);
+       return buf;
+     }
+     case STRING:
+       return quote(col.str_vec_val[i], delim);
+     default:
+       throw JamException("Cannot print columns of type " + Type2String(col.el_type));
+    }
+  }
+
+  static string quote(const string& x, char delim) {
+    if (x.find_first_of(string("\"\n\r") + delim) == string::npos)
+      return x;
+    string out = "\"";
+    for (char c : x) {
+      if (c == '"') out += '"';
+      out += c;
+    }
+    return out + "\"";
+  }
+
+ private:
+
+  static string format_time(double secs, const char* fmt) {
+    time_t t = static_cast<time_t>(std::floor(secs));
+    struct tm tm;
+#ifdef _WIN32
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+    char buf[64];
+    strftime(buf, sizeof(buf), fmt, &tm);
+    return buf;
+  }
+};
+
+// Print up to `nrows` rows of `path`; all rows when nrows is MAX_SIZE
+static int print_csv(const string& path, size_t nrows, char delim) {
+  Reader reader(path);
+  reader.fetch_header();
+  str_vec names = col_names(reader);
+  vector<CellFormatter> formatters;
+  for (size_t c = 0; c < names.size(); c++) {
+    formatters.emplace_back(reader.col_metas[c]);
+    std::cout << (c > 0 ? string(1, delim) : "") << CellFormatter::quote(names[c], delim);
+  }
+  std::cout << "\n";
+  size_t printed = 0;
+  while (printed < nrows) {
+    const vector<VarColl>& cols = reader.read_columns(1);
+    if (cols.empty()) break;
+    size_t n = std::min(cols[0].size(), nrows - printed);
+    for (size_t i = 0; i < n; i++) {
+      for (size_t c = 0; c < cols.size(); c++) {
+        if (c > 0) std::cout << delim;
+        std::cout << formatters[c].format(cols[c], i, delim);
+      }
+      std::cout << "\n";
+    }
+    printed += n;
+  }
+  return 0;
+}
+
+
+/* ------------------------------------------------------ */
+/* COMMANDS                                               */
+/* ------------------------------------------------------ */
+
+static int cmd_info(const string& path) {
+  Reader reader(path);
+  Description desc = reader.describe();
+  const Index& index = desc.index;
+  printf("file:      %s\n", path.c_str());
+  printf("size:      %llu bytes\n", (unsigned long long) desc.file_size);
+  printf("rows:      %zu\n", index.nrows());
+  printf("columns:   %zu\n", desc.col_metas.size());
+  printf("chunks:    %zu\n", index.chunks.size());
+  printf("indexed:   %s\n", desc.indexed ? "yes" : "no (scanned)");
+  printf("checksums: %s\n", index.has_crc ? "yes" : "no");
+  printf("\n%-4s %-24s %-8s %s\n", "#", "column", "type", "class");
+  for (size_t c = 0; c < desc.col_metas.size(); c++) {
+    Type type = c < index.col_types.size() ? index.col_types[c] : UNDEFINED;
+    bool list = index.coll_type(c) == LIST;
+    printf("%-4zu %-24s %-8s %s\n", c + 1, c < desc.names.size() ? desc.names[c].c_str() : "",
+           Type2String(type).c_str(), list ? "list" : col_class(desc.col_metas[c], type).c_str());
+  }
+  printf("\n%-6s %14s %12s %10s\n", "chunk", "offset", "bytes", "rows");
+  for (size_t i = 0; i < index.chunks.size(); i++) {
+    const ChunkInfo& ch = index.chunks[i];
+    printf("%-6zu %14llu %12llu %10llu\n", i + 1, (unsigned long long) ch.offset,
+           (unsigned long long) ch.nbytes, (unsigned long long) ch.nrows);
+  }
+  return 0;
+}
+
+// Copy chunks of `reader` to `writer`, keeping only columns `cols`
+static void copy_chunks(Reader& reader, Writer& writer, const vector<size_t>& cols) {
+  while (true) {
+    vector<VarColl>& chunk = reader.read_columns(1);
+    if (chunk.empty()) break;
+    vector<VarColl> out;
+    for (size_t c : cols)
+      out.push_back(std::move(chunk[c]));
+    writer.write_columns(out, MAX_SIZE, writer.index().chunks.size() > 0);
+  }
+}
+
+static vector<size_t> all_columns(size_t ncols) {
+  vector<size_t> out(ncols);
+  for (size_t c = 0; c < ncols; c++) out[c] = c;
+  return out;
+}
+
+static void check_output(const string& in, const string& out) {
+  if (in == out)
+    usage_error("output must differ from input '" + in + "'");
+}
+
+static int cmd_slice(const string& chunks, const string& in, const string& out) {
+  check_output(in, out);
+  Reader reader(in);
+  reader.fetch_header();
+  Writer writer(out, reader.meta, reader.col_metas);
+  reader.select(parse_ranges(chunks));
+  copy_chunks(reader, writer, all_columns(reader.ncols()));
+  writer.close();
+  return 0;
+}
+
+static int cmd_select(const string& columns, const string& in, const string& out) {
+  check_output(in, out);
+  Reader reader(in);
+  reader.fetch_header();
+  str_vec names = col_names(reader);
+  vector<size_t> cols;
+  str_vec out_names;
+  vector<strmap<VarColl>> col_metas;
+  for (const auto& name : split(columns, ',')) {
+    size_t c = std::find(names.begin(), names.end(), name) - names.begin();
+    if (c == names.size())
+      usage_error("unknown column '" + name + "'");
+    if (std::find(cols.begin(), cols.end(), c) != cols.end())
+      usage_error("duplicate column '" + name + "'");
+    cols.push_back(c);
+    out_names.push_back(name);
+    col_metas.push_back(reader.col_metas[c]);
+  }
+  strmap<VarColl> meta = reader.meta;
+  meta["names"] = VarColl(out_names);
+  Writer writer(out, meta, col_metas);
+  copy_chunks(reader, writer, cols);
+  writer.close();
+  return 0;
+}
+
+// Chunks are copied verbatim
+static int cmd_concat(const string& out, const str_vec& inputs) {
+  for (const auto& in : inputs)
+    check_output(in, out);
+  Writer writer(out);
+  for (const auto& in : inputs) {
+    Reader reader(in);
+    writer.append_chunks_from(reader);
+  }
+  writer.close();
+  return 0;
+}
+
+static int cmd_verify(const string& path) {
+  Reader reader(path);
+  if (!reader.verify(true)) {
+    printf("%s: no checksums\n", path.c_str());
+    return 1;
+  }
+  size_t nchunks = reader.nchunks();
+  while (!reader.read_columns(1).empty()) {}
+  const vector<size_t>& corrupted = reader.corrupted_chunks();
+  for (size_t i : corrupted)
+    printf("%s: chunk %zu is corrupted\n", path.c_str(), i + 1);
+  printf("%s: %zu of %zu chunks OK\n", path.c_str(), nchunks - corrupted.size(), nchunks);
+  return corrupted.empty() ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2)
+    usage_error("missing command");
+  string cmd = argv[1];
+  str_vec args;
+  strmap<string> opts;
+  for (int i = 2; i < argc; i++) {
+    string a = argv[i];
+    if (a == "-n" || a == "-d" || a == "--chunks" || a == "--columns") {
+      if (i + 1 == argc)
+        usage_error("missing value of " + a);
+      opts[a] = argv[++i];
+    } else if (a == "-h" || a == "--help") {
+      std::cout << USAGE;
+      return 0;
+    } else {
+      args.push_back(a);
+    }
+  }
+
+  try {
+    if (cmd == "info" && args.size() == 1)
+      return cmd_info(args[0]);
+    if (cmd == "head" && args.size() == 1)
+      return print_csv(args[0], opts.count("-n") ? parse_count(opts["-n"], "number of rows") : 10, ',');
+    if (cmd == "cat" && args.size() == 1)
+      return print_csv(args[0], MAX_SIZE, opts.count("-d") && !opts["-d"].empty() ? opts["-d"][0] : ',');
+    if (cmd == "slice" && args.size() == 2 && opts.count("--chunks"))
+      return cmd_slice(opts["--chunks"], args[0], args[1]);
+    if (cmd == "select" && args.size() == 2 && opts.count("--columns"))
+      return cmd_select(opts["--columns"], args[0], args[1]);
+    if (cmd == "concat" && args.size() >= 2)
+      return cmd_concat(args[0], str_vec(args.begin() + 1, args.end()));
+    if (cmd == "verify" && args.size() == 1)
+      return cmd_verify(args[0]);
+    if (cmd == "help") {
+      std::cout << USAGE;
+      return 0;
+    }
+  } catch (std::exception& e) {
+    std::cerr << "jamtool: " << e.what() << "\n";
+    return 1;
+  }
+  usage_error("invalid arguments to '" + cmd + "'");
+}
@@ -0,0 +1,23 @@
+// Generated by jamr::jar_codegen(). Example consumer of {{{name}}}.hpp.
+
+#include <iostream>
+
+#include "{{{name}}}.hpp"
+
+int main(int argc, char** argv) {
+  std::string path = argc > 1 ? argv[1] : "{{{source}}}";
+  try {
+    {{{name}}}::Reader reader(path);
+    {{{name}}}::Chunk chunk;
+    size_t nrows = 0;
+    while (reader.next(chunk)) {
+      nrows += chunk.size();
+{{{example}}}
+    }
+    std::cout << path << ": " << nrows << " rows in " << reader.nchunks() << " chunks\n";
+  } catch (std::exception& e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
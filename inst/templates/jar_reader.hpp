@@ -0,0 +1,107 @@
+// Generated by jamr::jar_codegen() from {{{source}}}. Do not edit by hand.
+//
+// Columns:
+{{{schema}}}
+//
+// Chunks of archives with exactly this schema are decoded into the typed
+// columns of {{{name}}}::Chunk with no per-element type dispatch.
+
+#ifndef {{{guard}}}
+#define {{{guard}}}
+
+#include <fstream>
+#include <string>
+
+#include "jam.hpp"
+
+namespace {{{name}}} {
+
+const size_t NCOLS = {{{ncols}}};
+
+// One chunk of the archive, stored by column
+struct Chunk {
+{{{fields}}}
+
+  size_t size() const { return {{{first}}}.size(); }
+};
+
+// Read a column of element type `el_type` into `out`
+template<class T>
+inline void decode_column(cereal::BinaryInputArchive& bin, std::vector<T>& out,
+                          jam::Type el_type, const char* name) {
+  jam::Type coll_type, type;
+  bin(coll_type, type);
+  if (coll_type != jam::VECTOR || type != el_type)
+    throw jam::JamException(std::string("Column '") + name + "' is " + jam::Type2String(type) +
+                            " rather than " + jam::Type2String(el_type));
+  bin(out);
+}
+
+// Read a LIST column of element type `el_type` into `out`
+template<class T>
+inline void decode_column(cereal::BinaryInputArchive& bin, jam::ListColumn<T>& out,
+                          jam::Type el_type, const char* name) {
+  jam::Type coll_type, type;
+  bin(coll_type, type);
+  if (coll_type != jam::LIST || type != el_type)
+    throw jam::JamException(std::string("Column '") + name + "' is " + jam::Type2String(coll_type) +
+                            " of " + jam::Type2String(type) + " rather than LIST of " +
+                            jam::Type2String(el_type));
+  bin(out);
+}
+
+// Decode the COLS payload of a chunk at the current position of `bin`
+inline void decode_chunk(cereal::BinaryInputArchive& bin, Chunk& out) {
+  cereal::size_type ncols;
+  bin(cereal::make_size_tag(ncols));
+  if (ncols != NCOLS)
+    throw jam::JamException("Chunk has " + std::to_string(ncols) + " columns rather than " +
+                            std::to_string(NCOLS));
+{{{decoders}}}
+}
+
+// Sequential reader of chunks. Chunk positions are taken from the index of
+// the archive, whose column types are checked against this schema.
+class Reader {
+
+  std::ifstream in_;
+  std::vector<jam::ChunkInfo> chunks_;
+  size_t next_ = 0;
+
+ public:
+
+  explicit Reader(const std::string& path) : in_(path, std::ios::binary) {
+    if (!in_)
+      throw jam::JamException("Cannot open file '" + path + "'");
+    jam::Reader reader(path);
+    const jam::Index& index = reader.fetch_index();
+    const std::vector<jam::Type> types = { {{{types}}} };
+    const std::vector<jam::Type> coll_types = { {{{coll_types}}} };
+    if (!index.chunks.empty() && (index.col_types != types || index.coll_types != coll_types))
+      throw jam::JamException("Columns of '" + path + "' don't match the schema of {{{name}}}");
+    chunks_ = index.chunks;
+  }
+
+  size_t nchunks() const { return chunks_.size(); }
+
+  size_t nrows() const {
+    size_t n = 0;
+    for (const auto& info : chunks_)
+      n += info.nrows;
+    return n;
+  }
+
+  // Decode the next chunk into `out`. Return false at the end of the archive.
+  bool next(Chunk& out) {
+    if (next_ >= chunks_.size())
+      return false;
+    in_.seekg(chunks_[next_++].offset);
+    cereal::BinaryInputArchive bin(in_);
+    decode_chunk(bin, out);
+    return true;
+  }
+};
+
+}
+
+#endif
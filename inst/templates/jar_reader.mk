@@ -0,0 +1,18 @@
+# Generated by jamr::jar_codegen().
+#
+#   make                      build ./{{{name}}}
+#   make JAM_SRC=/path/to/src where jam.hpp lives (and cereal/, unless CEREAL
+#                             is given)
+
+CXX ?= g++
+CXXFLAGS ?= -O2
+JAM_SRC ?= {{{jam_src}}}
+CEREAL ?= $(JAM_SRC)
+
+{{{name}}}: main.cpp {{{name}}}.hpp
+	$(CXX) -std=c++11 $(CXXFLAGS) -pthread -I. -I$(JAM_SRC) -I$(CEREAL) -o $@ main.cpp
+
+clean:
+	rm -f {{{name}}}
+
+.PHONY: clean
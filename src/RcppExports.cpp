@@ -5,62 +5,200 @@
 
 using namespace Rcpp;
 
+// c_jar_aggregate
+SEXP c_jar_aggregate(const std::string& path, std::vector<int> by, std::vector<int> sum, std::vector<int> mean, std::vector<int> min, std::vector<int> max, bool count, int threads);
+RcppExport SEXP jamr_c_jar_aggregate(SEXP pathSEXP, SEXP bySEXP, SEXP sumSEXP, SEXP meanSEXP, SEXP minSEXP, SEXP maxSEXP, SEXP countSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type by(bySEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type sum(sumSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type mean(meanSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type min(minSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type max(maxSEXP);
+    Rcpp::traits::input_parameter< bool >::type count(countSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(c_jar_aggregate(path, by, sum, mean, min, max, count, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// c_jar_delim
+double c_jar_delim(const std::string& in_file, const std::string& out_file, const std::string& delim, const std::string& quote, const std::string& decimal_mark, bool header, std::vector<std::string> col_names, const std::string& col_types, std::vector<std::string> na, double guess_max, double chunk_size, int threads);
+RcppExport SEXP jamr_c_jar_delim(SEXP in_fileSEXP, SEXP out_fileSEXP, SEXP delimSEXP, SEXP quoteSEXP, SEXP decimal_markSEXP, SEXP headerSEXP, SEXP col_namesSEXP, SEXP col_typesSEXP, SEXP naSEXP, SEXP guess_maxSEXP, SEXP chunk_sizeSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type in_file(in_fileSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type out_file(out_fileSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type delim(delimSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type quote(quoteSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type decimal_mark(decimal_markSEXP);
+    Rcpp::traits::input_parameter< bool >::type header(headerSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type col_names(col_namesSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type col_types(col_typesSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type na(naSEXP);
+    Rcpp::traits::input_parameter< double >::type guess_max(guess_maxSEXP);
+    Rcpp::traits::input_parameter< double >::type chunk_size(chunk_sizeSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(c_jar_delim(in_file, out_file, delim, quote, decimal_mark, header, col_names, col_types, na, guess_max, chunk_size, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// c_unjar_files
+List c_unjar_files(std::vector<std::string> paths, int threads, List filter);
+RcppExport SEXP jamr_c_unjar_files(SEXP pathsSEXP, SEXP threadsSEXP, SEXP filterSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type paths(pathsSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< List >::type filter(filterSEXP);
+    rcpp_result_gen = Rcpp::wrap(c_unjar_files(paths, threads, filter));
+    return rcpp_result_gen;
+END_RCPP
+}
+// c_jam_info
+SEXP c_jam_info(const std::string& path);
+RcppExport SEXP jamr_c_jam_info(SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(c_jam_info(path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// c_jar_info
+SEXP c_jar_info(const std::string& path);
+RcppExport SEXP jamr_c_jar_info(SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(c_jar_info(path));
+    return rcpp_result_gen;
+END_RCPP
+}
 // c_jam
-void c_jam(SEXP x, const std::string path);
-RcppExport SEXP jamr_c_jam(SEXP xSEXP, SEXP pathSEXP) {
+void c_jam(SEXP x, const std::string path, bool checksum, bool aligned, int dedup);
+RcppExport SEXP jamr_c_jam(SEXP xSEXP, SEXP pathSEXP, SEXP checksumSEXP, SEXP alignedSEXP, SEXP dedupSEXP) {
 BEGIN_RCPP
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
     Rcpp::traits::input_parameter< const std::string >::type path(pathSEXP);
-    c_jam(x, path);
+    Rcpp::traits::input_parameter< bool >::type checksum(checksumSEXP);
+    Rcpp::traits::input_parameter< bool >::type aligned(alignedSEXP);
+    Rcpp::traits::input_parameter< int >::type dedup(dedupSEXP);
+    c_jam(x, path, checksum, aligned, dedup);
     return R_NilValue;
 END_RCPP
 }
+// c_jam_stats
+SEXP c_jam_stats();
+RcppExport SEXP jamr_c_jam_stats() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(c_jam_stats());
+    return rcpp_result_gen;
+END_RCPP
+}
 // c_jar
-void c_jar(SEXP x, const std::string& path, bool append, int rows_per_chunk);
-RcppExport SEXP jamr_c_jar(SEXP xSEXP, SEXP pathSEXP, SEXP appendSEXP, SEXP rows_per_chunkSEXP) {
+void c_jar(SEXP x, const std::string& path, bool append, int rows_per_chunk, std::vector<std::string> bloom);
+RcppExport SEXP jamr_c_jar(SEXP xSEXP, SEXP pathSEXP, SEXP appendSEXP, SEXP rows_per_chunkSEXP, SEXP bloomSEXP) {
 BEGIN_RCPP
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
     Rcpp::traits::input_parameter< bool >::type append(appendSEXP);
     Rcpp::traits::input_parameter< int >::type rows_per_chunk(rows_per_chunkSEXP);
-    c_jar(x, path, append, rows_per_chunk);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type bloom(bloomSEXP);
+    c_jar(x, path, append, rows_per_chunk, bloom);
+    return R_NilValue;
+END_RCPP
+}
+// c_jar_concat
+void c_jar_concat(std::vector<std::string> files, const std::string& out);
+RcppExport SEXP jamr_c_jar_concat(SEXP filesSEXP, SEXP outSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type files(filesSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type out(outSEXP);
+    c_jar_concat(files, out);
+    return R_NilValue;
+END_RCPP
+}
+// c_jar_sort
+void c_jar_sort(const std::string& path, const std::string& out, std::vector<int> by, double memory, const std::string& tmp_prefix, int rows_per_chunk);
+RcppExport SEXP jamr_c_jar_sort(SEXP pathSEXP, SEXP outSEXP, SEXP bySEXP, SEXP memorySEXP, SEXP tmp_prefixSEXP, SEXP rows_per_chunkSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type out(outSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type by(bySEXP);
+    Rcpp::traits::input_parameter< double >::type memory(memorySEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type tmp_prefix(tmp_prefixSEXP);
+    Rcpp::traits::input_parameter< int >::type rows_per_chunk(rows_per_chunkSEXP);
+    c_jar_sort(path, out, by, memory, tmp_prefix, rows_per_chunk);
     return R_NilValue;
 END_RCPP
 }
 // c_unjam
-SEXP c_unjam(const std::string& path);
-RcppExport SEXP jamr_c_unjam(SEXP pathSEXP) {
+SEXP c_unjam(const std::string& path, bool verify, double n);
+RcppExport SEXP jamr_c_unjam(SEXP pathSEXP, SEXP verifySEXP, SEXP nSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
-    rcpp_result_gen = Rcpp::wrap(c_unjam(path));
+    Rcpp::traits::input_parameter< bool >::type verify(verifySEXP);
+    Rcpp::traits::input_parameter< double >::type n(nSEXP);
+    rcpp_result_gen = Rcpp::wrap(c_unjam(path, verify, n));
     return rcpp_result_gen;
 END_RCPP
 }
 // c_unjar_bind
-SEXP c_unjar_bind(const std::string& path, int chunks);
-RcppExport SEXP jamr_c_unjar_bind(SEXP pathSEXP, SEXP chunksSEXP) {
+SEXP c_unjar_bind(const std::string& path, int chunks, int prefetch, int threads, bool verify, bool skip_corrupted, List filter);
+RcppExport SEXP jamr_c_unjar_bind(SEXP pathSEXP, SEXP chunksSEXP, SEXP prefetchSEXP, SEXP threadsSEXP, SEXP verifySEXP, SEXP skip_corruptedSEXP, SEXP filterSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
     Rcpp::traits::input_parameter< int >::type chunks(chunksSEXP);
-    rcpp_result_gen = Rcpp::wrap(c_unjar_bind(path, chunks));
+    Rcpp::traits::input_parameter< int >::type prefetch(prefetchSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verify(verifySEXP);
+    Rcpp::traits::input_parameter< bool >::type skip_corrupted(skip_corruptedSEXP);
+    Rcpp::traits::input_parameter< List >::type filter(filterSEXP);
+    rcpp_result_gen = Rcpp::wrap(c_unjar_bind(path, chunks, prefetch, threads, verify, skip_corrupted, filter));
     return rcpp_result_gen;
 END_RCPP
 }
 // c_unjar_nobind
-SEXP c_unjar_nobind(const std::string& path, int chunks);
-RcppExport SEXP jamr_c_unjar_nobind(SEXP pathSEXP, SEXP chunksSEXP) {
+SEXP c_unjar_nobind(const std::string& path, int chunks, int prefetch, bool verify, bool skip_corrupted, List filter);
+RcppExport SEXP jamr_c_unjar_nobind(SEXP pathSEXP, SEXP chunksSEXP, SEXP prefetchSEXP, SEXP verifySEXP, SEXP skip_corruptedSEXP, SEXP filterSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
     Rcpp::traits::input_parameter< int >::type chunks(chunksSEXP);
-    rcpp_result_gen = Rcpp::wrap(c_unjar_nobind(path, chunks));
+    Rcpp::traits::input_parameter< int >::type prefetch(prefetchSEXP);
+    Rcpp::traits::input_parameter< bool >::type verify(verifySEXP);
+    Rcpp::traits::input_parameter< bool >::type skip_corrupted(skip_corruptedSEXP);
+    Rcpp::traits::input_parameter< List >::type filter(filterSEXP);
+    rcpp_result_gen = Rcpp::wrap(c_unjar_nobind(path, chunks, prefetch, verify, skip_corrupted, filter));
+    return rcpp_result_gen;
+END_RCPP
+}
+// c_unjar_rows
+SEXP c_unjar_rows(const std::string& path, std::vector<double> rows);
+RcppExport SEXP jamr_c_unjar_rows(SEXP pathSEXP, SEXP rowsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< std::vector<double> >::type rows(rowsSEXP);
+    rcpp_result_gen = Rcpp::wrap(c_unjar_rows(path, rows));
     return rcpp_result_gen;
 END_RCPP
 }
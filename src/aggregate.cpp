@@ -0,0 +1,73 @@
+#include "rutils.hpp"
+#include "aggregate.hpp"
+
+// Group-by aggregation of jar archives. Only the aggregated groups reach R.
+
+// Statistics with no non-missing values are NA
+NumericVector agg_column(const dbl_vec& x, const dbl_vec& counts) {
+  NumericVector out(x.size());
+  for (size_t i = 0; i < x.size(); i++)
+    out[i] = counts[i] > 0 ? x[i] : NA_REAL;
+  return out;
+}
+
+// [[Rcpp::export]]
+SEXP c_jar_aggregate(const std::string& path, std::vector<int> by,
+                     std::vector<int> sum, std::vector<int> mean,
+                     std::vector<int> min, std::vector<int> max,
+                     bool count, int threads) {
+  AggSpec spec;
+  spec.by.assign(by.begin(), by.end());
+  spec.sum.assign(sum.begin(), sum.end());
+  spec.mean.assign(mean.begin(), mean.end());
+  spec.min.assign(min.begin(), min.end());
+  spec.max.assign(max.begin(), max.end());
+  spec.threads = threads > 0 ? threads : 1;
+
+  Aggregator agg(path, spec);
+  GroupTable groups = agg.run();
+  size_t ngroups = groups.size();
+
+  List out;
+  std::vector<std::string> names;
+  for (size_t k = 0; k < spec.by.size(); k++) {
+    SEXP col = PROTECT(VarColl2SEXP(groups.keys[k]));
+    set_col_attributes(col, agg.col_metas[spec.by[k]]);
+    out.push_back(col);
+    UNPROTECT(1);
+    names.push_back(agg.names[spec.by[k]]);
+  }
+  for (size_t c : spec.sum) {
+    size_t v = agg.value_index(c);
+    out.push_back(wrap(groups.sums[v]));
+    names.push_back(agg.names[c] + "_sum");
+  }
+  for (size_t c : spec.mean) {
+    size_t v = agg.value_index(c);
+    dbl_vec means(ngroups);
+    for (size_t g = 0; g < ngroups; g++)
+      means[g] = groups.sums[v][g] / groups.counts[v][g];
+    out.push_back(agg_column(means, groups.counts[v]));
+    names.push_back(agg.names[c] + "_mean");
+  }
+  for (size_t c : spec.min) {
+    size_t v = agg.value_index(c);
+    out.push_back(agg_column(groups.mins[v], groups.counts[v]));
+    names.push_back(agg.names[c] + "_min");
+  }
+  for (size_t c : spec.max) {
+    size_t v = agg.value_index(c);
+    out.push_back(agg_column(groups.maxs[v], groups.counts[v]));
+    names.push_back(agg.names[c] + "_max");
+  }
+  if (count) {
+    out.push_back(wrap(groups.rows));
+    names.push_back("count");
+  }
+
+  out.attr("names") = wrap(names);
+  out.attr("class") = "data.frame";
+  out.attr("row.names") = IntegerVector::create(NA_INTEGER, -static_cast<int>(ngroups));
+  last_stats = agg.stats;
+  return out;
+}
@@ -0,0 +1,317 @@
+#ifndef __JAM_AGGREGATE_HPP__
+#define __JAM_AGGREGATE_HPP__
+
+// Streaming group-by aggregation over jar archives. Independent of R.
+//
+// Chunks are read through Reader and folded into an open addressing hash
+// table of partial aggregates, so memory is proportional to the number of
+// groups. With several threads each thread folds its share of chunks into
+// its own table and the tables are merged at the end.
+
+#include <thread>
+
+#include "jam.hpp"
+
+namespace jam {
+
+struct AggSpec {
+  vector<size_t> by;           // key columns
+  vector<size_t> sum;          // value columns of each statistic
+  vector<size_t> mean;
+  vector<size_t> min;
+  vector<size_t> max;
+  size_t threads = 1;
+};
+
+// Hash of element i of a key column. NAs hash alike; so do 0 and -0.
+inline ulong key_hash(const VarColl& col, size_t i) {
+  switch (col.el_type) {
+   case INT:
+     return bloom_hash(col.int_vec_val[i]);
+   case LONG:
+     return bloom_mix(static_cast<ulong>(col.long_vec_val[i]));
+   case DOUBLE: {
+     double x = col.dbl_vec_val[i];
+     if (std::isnan(x)) x = NAN;
+     if (x == 0) x = 0;
+     ulong bits;
+     memcpy(&bits, &x, sizeof(bits));
+     return bloom_mix(bits);
+   }
+   case STRING:
+     return bloom_hash(col.str_vec_val[i]);
+   default:
+     throw JamException("Cannot group by columns of type " + Type2String(col.el_type));
+  }
+}
+
+// Partial aggregates of all groups seen so far. Keys are stored column-wise
+// in the layout of the input columns.
+class GroupTable {
+
+  vector<size_t> slots_;       // group index + 1; 0 for empty slots
+  vector<ulong> hashes_;       // of each group
+  size_t nvals_ = 0;
+
+ public:
+
+  vector<VarColl> keys;
+  dbl_vec rows;                 // number of rows of each group
+  vector<dbl_vec> sums;         // per value column: sum of non-NA values
+  vector<dbl_vec> counts;       // number of non-NA values
+  vector<dbl_vec> mins;
+  vector<dbl_vec> maxs;
+
+  GroupTable(const vector<Type>& key_types, size_t nvals) :
+    slots_(1024, 0), nvals_(nvals),
+    sums(nvals), counts(nvals), mins(nvals), maxs(nvals) {
+    for (Type t : key_types)
+      keys.push_back(VarColl(VECTOR, t));
+  }
+
+  size_t size() const {
+    return rows.size();
+  }
+
+  // Index of the group of row i of `cols` (key columns `by`); new groups
+  // are created on the way.
+  size_t group(const vector<VarColl>& cols, const vector<size_t>& by, size_t i, ulong h) {
+    size_t mask = slots_.size() - 1;
+    for (size_t s = h & mask; ; s = (s + 1) & mask) {
+      size_t g = slots_[s];
+      if (g == 0) {
+        g = add_group(h);
+        for (size_t k = 0; k < by.size(); k++)
+          keys[k].append(cols[by[k]], i, i + 1);
+        slots_[s] = g + 1;
+        if (size() * 2 > slots_.size())
+          rehash();
+        return g;
+      }
+      if (hashes_[g - 1] == h && same_key(g - 1, cols, by, i))
+        return g - 1;
+    }
+  }
+
+  void add(size_t g, size_t v, double x) {
+    if (std::isnan(x)) return;
+    sums[v][g] += x;
+    counts[v][g] += 1;
+    if (x < mins[v][g]) mins[v][g] = x;
+    if (x > maxs[v][g]) maxs[v][g] = x;
+  }
+
+  // Fold groups of `other` into this table
+  void merge(const GroupTable& other) {
+    vector<size_t> all(other.keys.size());
+    for (size_t k = 0; k < all.size(); k++) all[k] = k;
+    for (size_t og = 0; og < other.size(); og++) {
+      size_t g = group(other.keys, all, og, other.hashes_[og]);
+      rows[g] += other.rows[og];
+      for (size_t v = 0; v < nvals_; v++) {
+        sums[v][g] += other.sums[v][og];
+        counts[v][g] += other.counts[v][og];
+        mins[v][g] = std::min(mins[v][g], other.mins[v][og]);
+        maxs[v][g] = std::max(maxs[v][g], other.maxs[v][og]);
+      }
+    }
+  }
+
+ private:
+
+  size_t add_group(ulong h) {
+    hashes_.push_back(h);
+    rows.push_back(0);
+    for (size_t v = 0; v < nvals_; v++) {
+      sums[v].push_back(0);
+      counts[v].push_back(0);
+      mins[v].push_back(INFINITY);
+      maxs[v].push_back(-INFINITY);
+    }
+    return size() - 1;
+  }
+
+  bool same_key(size_t g, const vector<VarColl>& cols, const vector<size_t>& by, size_t i) const {
+    for (size_t k = 0; k < by.size(); k++) {
+      const VarColl& a = keys[k];
+      const VarColl& b = cols[by[k]];
+      switch (a.el_type) {
+       case INT:
+         if (a.int_vec_val[g] != b.int_vec_val[i]) return false;
+         break;
+       case LONG:
+         if (a.long_vec_val[g] != b.long_vec_val[i]) return false;
+         break;
+       case DOUBLE: {
+         double x = a.dbl_vec_val[g], y = b.dbl_vec_val[i];
+         if (!(x == y || (std::isnan(x) && std::isnan(y)))) return false;
+         break;
+       }
+       default:
+         if (a.str_vec_val[g] != b.str_vec_val[i]) return false;
+      }
+    }
+    return true;
+  }
+
+  void rehash() {
+    slots_.assign(slots_.size() * 2, 0);
+    size_t mask = slots_.size() - 1;
+    for (size_t g = 0; g < size(); g++) {
+      size_t s = hashes_[g] & mask;
+      while (slots_[s] != 0) s = (s + 1) & mask;
+      slots_[s] = g + 1;
+    }
+  }
+};
+
+class Aggregator {
+
+  string path_;
+  AggSpec spec_;
+  vector<size_t> vals_;        // distinct value columns
+  vector<Type> types_;
+
+ public:
+
+  Stats stats;
+  str_vec names;
+  vector<strmap<VarColl>> col_metas;
+
+  Aggregator(const string& path, const AggSpec& spec) : path_(path), spec_(spec) {
+    for (const auto* cols : {&spec.sum, &spec.mean, &spec.min, &spec.max})
+      for (size_t c : *cols)
+        if (std::find(vals_.begin(), vals_.end(), c) == vals_.end())
+          vals_.push_back(c);
+  }
+
+  // Position of column `col` among the value columns
+  size_t value_index(size_t col) const {
+    return std::find(vals_.begin(), vals_.end(), col) - vals_.begin();
+  }
+
+  // Groups in key order
+  GroupTable run() {
+    Reader reader(path_);
+    const Index& index = reader.fetch_index();
+    reader.fetch_header();
+    names = reader.names();
+    col_metas = reader.col_metas;
+    types_ = index.col_types;
+    vector<Type> key_types;
+    for (size_t c : spec_.by) {
+      check_column(index, c);
+      key_types.push_back(types_[c]);
+    }
+    for (size_t c : vals_) {
+      check_column(index, c);
+      if (types_[c] != INT && types_[c] != LONG && types_[c] != DOUBLE)
+        throw JamException("Cannot aggregate columns of type " + Type2String(types_[c]));
+    }
+
+    size_t nthreads = std::max<size_t>(1, std::min(spec_.threads, index.chunks.size()));
+    vector<GroupTable> tables(nthreads, GroupTable(key_types, vals_.size()));
+    vector<Stats> thread_stats(nthreads);
+    vector<string> errors(nthreads);
+    if (nthreads == 1) {
+      fold(reader, tables[0]);
+      stats.merge(reader.stats);
+    } else {
+      vector<std::thread> workers;
+      for (size_t t = 0; t < nthreads; t++) {
+        workers.emplace_back([&, t]() {
+            try {
+              Reader r(path_);
+              vector<size_t> chunks;
+              for (size_t i = t; i < index.chunks.size(); i += nthreads)
+                chunks.push_back(i);
+              r.select(chunks);
+              fold(r, tables[t]);
+              thread_stats[t] = r.stats;
+            } catch (std::exception& e) {
+              errors[t] = e.what();
+            }
+          });
+      }
+      for (auto& w : workers) w.join();
+      for (size_t t = 0; t < nthreads; t++) {
+        if (!errors[t].empty())
+          throw JamException(errors[t]);
+        stats.merge(thread_stats[t]);
+        if (t > 0) {
+          StatsTimer timer(stats.encode_time);
+          tables[0].merge(tables[t]);
+        }
+      }
+    }
+    return sorted(tables[0]);
+  }
+
+ private:
+
+  void check_column(const Index& index, size_t c) const {
+    if (c >= types_.size())
+      throw JamException("Column " + std::to_string(c) + " is out of range");
+    if (index.coll_type(c) != VECTOR)
+      throw JamException("Cannot group by or aggregate LIST column " + std::to_string(c));
+  }
+
+  void fold(Reader& reader, GroupTable& table) {
+    const vector<size_t>& vals = vals_;
+    while (true) {
+      vector<VarColl>& cols = reader.read_columns(1);
+      if (cols.empty()) break;
+      size_t n = cols[0].size();
+      StatsTimer timer(reader.stats.encode_time);
+      for (size_t i = 0; i < n; i++) {
+        ulong h = 0;
+        for (size_t c : spec_.by)
+          h = h * 0x9E3779B97F4A7C15ULL + key_hash(cols[c], i);
+        size_t g = table.group(cols, spec_.by, i, h);
+        table.rows[g] += 1;
+        for (size_t v = 0; v < vals.size(); v++) {
+          const VarColl& col = cols[vals[v]];
+          if (col.el_type == INT) {
+            int x = col.int_vec_val[i];
+            if (x != NA_INT) table.add(g, v, x);
+          } else if (col.el_type == LONG) {
+            int64_t x = col.long_vec_val[i];
+            if (x != NA_LONG) table.add(g, v, static_cast<double>(x));
+          } else {
+            table.add(g, v, col.dbl_vec_val[i]);
+          }
+        }
+      }
+    }
+  }
+
+  // Copy of `table` with groups ordered by key
+  GroupTable sorted(const GroupTable& table) {
+    StatsTimer timer(stats.encode_time);
+    vector<size_t> idx(table.size()), all(table.keys.size());
+    for (size_t i = 0; i < idx.size(); i++) idx[i] = i;
+    for (size_t k = 0; k < all.size(); k++) all[k] = k;
+    std::sort(idx.begin(), idx.end(), [&](size_t i, size_t j) {
+        return compare_rows(table.keys, i, table.keys, j, all) < 0;
+      });
+    GroupTable out(table);
+    for (auto& k : out.keys) k = k.take(idx);
+    auto permute = [&](const dbl_vec& x) {
+      dbl_vec y(x.size());
+      for (size_t i = 0; i < idx.size(); i++) y[i] = x[idx[i]];
+      return y;
+    };
+    out.rows = permute(table.rows);
+    for (size_t v = 0; v < vals_.size(); v++) {
+      out.sums[v] = permute(table.sums[v]);
+      out.counts[v] = permute(table.counts[v]);
+      out.mins[v] = permute(table.mins[v]);
+      out.maxs[v] = permute(table.maxs[v]);
+    }
+    return out;
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,28 @@
+#include "rutils.hpp"
+#include "csv.hpp"
+
+// [[Rcpp::export]]
+double c_jar_delim(const std::string& in_file, const std::string& out_file,
+                   const std::string& delim, const std::string& quote,
+                   const std::string& decimal_mark, bool header,
+                   std::vector<std::string> col_names, const std::string& col_types,
+                   std::vector<std::string> na, double guess_max, double chunk_size,
+                   int threads) {
+  if (delim.size() != 1 || quote.size() != 1 || decimal_mark.size() != 1)
+    stop("'delim', 'quote' and 'decimal_mark' must be single characters.");
+  CsvOptions opts;
+  opts.delim = delim[0];
+  opts.quote = quote[0];
+  opts.decimal = decimal_mark[0];
+  opts.header = header;
+  opts.col_names = col_names;
+  opts.col_types = col_types;
+  opts.na = na;
+  opts.guess_rows = std::isfinite(guess_max) ? static_cast<size_t>(std::max(guess_max, 1.0)) : 0;
+  opts.chunk_rows = static_cast<size_t>(std::max(chunk_size, 1.0));
+  opts.threads = std::max(threads, 1);
+  CsvConverter converter(in_file, opts);
+  converter.convert(out_file);
+  last_stats = converter.stats;
+  return static_cast<double>(converter.problems);
+}
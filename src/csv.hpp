@@ -0,0 +1,475 @@
+#ifndef __JAM_CSV_HPP__
+#define __JAM_CSV_HPP__
+
+// Conversion of delimited text files into jar archives. Independent of R.
+//
+// The input is memory mapped and cut at record boundaries into blocks of
+// about `chunk_rows` rows. Blocks are parsed concurrently straight into
+// VarColl columns and written in order, one chunk per block, by a Writer.
+
+#include <cstdlib>
+#include <cerrno>
+#include <deque>
+#include <thread>
+
+#include "jam.hpp"
+
+namespace jam {
+
+struct CsvOptions {
+  char delim = ',';
+  char quote = '"';
+  char decimal = '.';
+  bool header = true;
+  str_vec col_names;          // overrides header names when not empty
+  string col_types;           // one of "icd?_" per column; empty to guess
+  str_vec na = {"", "NA"};
+  size_t guess_rows = 1000;   // rows used for type guessing; 0 for all
+  size_t chunk_rows = 1000000;
+  size_t threads = 1;
+};
+
+
+/* ------------------------------------------------------ */
+/* RECORDS                                                */
+/* ------------------------------------------------------ */
+
+struct Field {
+  const char* p;
+  size_t n;
+};
+
+// Split the record starting at `p` into `fields`. Quoted fields may contain
+// delimiters, newlines and doubled quotes; the latter are unescaped into
+// `scratch`. Return the start of the next record.
+inline const char* read_record(const char* p, const char* end, char delim, char quote,
+                               vector<Field>& fields, std::deque<string>& scratch) {
+  fields.clear();
+  scratch.clear();
+  while (true) {
+    const char* start = p;
+    if (p < end && *p == quote) {
+      p++;
+      start = p;
+      bool escaped = false;
+      while (p < end) {
+        if (*p == quote) {
+          if (p + 1 < end && p[1] == quote) {
+            escaped = true;
+            p += 2;
+            continue;
+          }
+          break;
+        }
+        p++;
+      }
+      if (escaped) {
+        scratch.emplace_back();
+        string& s = scratch.back();
+        for (const char* q = start; q < p; q++) {
+          s.push_back(*q);
+          if (*q == quote) q++;
+        }
+        fields.push_back(Field{s.data(), s.size()});
+      } else {
+        fields.push_back(Field{start, (size_t) (p - start)});
+      }
+      if (p < end) p++; // closing quote
+      // skip garbage up to the delimiter
+      while (p < end && *p != delim && *p != '\n') p++;
+    } else {
+      while (p < end && *p != delim && *p != '\n') p++;
+      size_t n = p - start;
+      if (n > 0 && start[n - 1] == '\r' && (p == end || *p == '\n')) n--;
+      fields.push_back(Field{start, n});
+    }
+    if (p == end)
+      return end;
+    if (*p == '\n')
+      return p + 1;
+    p++; // delimiter
+  }
+}
+
+// Position past the first record end at or after `from`, where `begin` is a
+// record start. Quotes are tracked from `begin`, so newlines inside quoted
+// fields are never taken for record ends.
+inline const char* record_boundary(const char* begin, const char* from, const char* end, char quote) {
+  if (from >= end)
+    return end;
+  bool quoted = false;
+  const char* p = begin;
+  while (true) {
+    const char* q = static_cast<const char*>(memchr(p, quote, end - p));
+    if (!q || q >= from) break;
+    quoted = !quoted;
+    p = q + 1;
+  }
+  p = from;
+  while (p < end) {
+    if (quoted) {
+      const char* q = static_cast<const char*>(memchr(p, quote, end - p));
+      if (!q) return end;
+      quoted = false;
+      p = q + 1;
+    } else {
+      const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+      const char* q = static_cast<const char*>(memchr(p, quote, (nl ? nl : end) - p));
+      if (!q) return nl ? nl + 1 : end;
+      quoted = true;
+      p = q + 1;
+    }
+  }
+  return end;
+}
+
+inline bool is_blank_record(const char* p, const char* end) {
+  return p < end && (*p == '\n' || (*p == '\r' && p + 1 < end && p[1] == '\n'));
+}
+
+
+/* ------------------------------------------------------ */
+/* FIELDS                                                 */
+/* ------------------------------------------------------ */
+
+inline bool parse_int(const Field& f, int& out) {
+  const char* p = f.p;
+  const char* end = f.p + f.n;
+  if (p == end) return false;
+  bool neg = false;
+  if (*p == '-' || *p == '+') {
+    neg = *p == '-';
+    if (++p == end) return false;
+  }
+  long x = 0;
+  for (; p < end; p++) {
+    if (*p < '0' || *p > '9') return false;
+    x = x * 10 + (*p - '0');
+    if (x > MAX_INT) return false;
+  }
+  out = static_cast<int>(neg ? -x : x);
+  return true;
+}
+
+inline bool parse_double(const Field& f, double& out, char decimal = '.') {
+  if (f.n == 0 || f.n > 63) return false;
+  char buf[64];
+  memcpy(buf, f.p, f.n);
+  buf[f.n] = 0;
+  if (decimal != '.') {
+    if (memchr(buf, '.', f.n)) return false;
+    char* d = static_cast<char*>(memchr(buf, decimal, f.n));
+    if (d) *d = '.';
+  }
+  char* e;
+  out = strtod(buf, &e);
+  return e == buf + f.n;
+}
+
+// Guessed types only widen: INT -> DOUBLE -> STRING. NIL for NA fields.
+inline Type guess_type(const Field& f, char decimal = '.') {
+  int i;
+  double d;
+  if (parse_int(f, i)) return INT;
+  if (parse_double(f, d, decimal)) return DOUBLE;
+  return STRING;
+}
+
+inline Type wider_type(Type a, Type b) {
+  if (a == NIL) return b;
+  if (b == NIL) return a;
+  if (a == STRING || b == STRING) return STRING;
+  if (a == DOUBLE || b == DOUBLE) return DOUBLE;
+  return INT;
+}
+
+
+/* ------------------------------------------------------ */
+/* CONVERTER                                              */
+/* ------------------------------------------------------ */
+
+class CsvConverter {
+
+  const CsvOptions opts_;
+  MappedFile file_;
+  const char* data_;           // first data record
+  vector<Type> types_;         // one per input field; NIL for skipped
+  str_vec names_;              // of written columns
+  size_t block_bytes_ = 1 << 20;
+
+  struct Block {
+    const char* begin;
+    const char* end;
+    vector<VarColl> cols;
+    size_t nrows = 0;
+    size_t problems = 0;
+    string error;
+    Block(const char* begin, const char* end) : begin(begin), end(end) {}
+  };
+
+  // Join workers on the way out, also when writing fails
+  struct Workers : vector<std::thread> {
+    void join() {
+      for (auto& w : *this) w.join();
+      clear();
+    }
+    ~Workers() { join(); }
+  };
+
+ public:
+
+  Stats stats;
+  size_t problems = 0;         // records with unexpected number of fields
+
+  CsvConverter(const string& path, const CsvOptions& opts) :
+    opts_(opts), file_(path) {
+    data_ = file_.begin();
+    if (file_.size() >= 3 && memcmp(data_, "\xEF\xBB\xBF", 3) == 0)
+      data_ += 3;
+    init_columns();
+  }
+
+  const str_vec& names() const {
+    return names_;
+  }
+
+  const vector<Type>& types() const {
+    return types_;
+  }
+
+  void convert(const string& out) {
+    Writer writer(out, strmap<VarColl>(), names_.size());
+    writer.meta["names"] = VarColl(names_);
+    writer.meta["class"] = VarColl(str_vec{"data.frame"});
+
+    size_t nthreads = std::max<size_t>(opts_.threads, 1);
+    const char* p = data_;
+    const char* end = file_.end();
+    vector<Block> current, next;
+    Workers workers;
+
+    auto launch = [&](vector<Block>& blocks) {
+      blocks.clear();
+      while (blocks.size() < nthreads && p < end) {
+        const char* q = record_boundary(p, p + std::min<size_t>(block_bytes_, end - p), end, opts_.quote);
+        blocks.push_back(Block(p, q));
+        p = q;
+      }
+      for (auto& b : blocks)
+        workers.emplace_back([this, &b]() { parse_block(b); });
+    };
+
+    launch(current);
+    while (!current.empty()) {
+      {
+        // waiting for the parsers
+        StatsTimer timer(stats.encode_time);
+        workers.join();
+      }
+      // parse the next batch while this one is written
+      launch(next);
+      for (auto& b : current) {
+        if (!b.error.empty())
+          throw JamException(b.error);
+        problems += b.problems;
+        if (b.nrows > 0)
+          writer.write_columns(b.cols, MAX_SIZE, writer.index().chunks.size() > 0);
+      }
+      std::swap(current, next);
+    }
+    if (writer.index().chunks.empty())
+      writer.write_columns(empty_columns());
+    writer.close();
+    stats.merge(writer.stats);
+  }
+
+ private:
+
+  vector<VarColl> empty_columns() const {
+    vector<VarColl> out;
+    for (Type t : types_)
+      if (t != NIL)
+        out.push_back(VarColl(VECTOR, t));
+    return out;
+  }
+
+  bool is_na(const Field& f) const {
+    for (const auto& na : opts_.na)
+      if (na.size() == f.n && memcmp(na.data(), f.p, f.n) == 0)
+        return true;
+    return false;
+  }
+
+  // Names from the header, types from col_types or from the first
+  // `guess_rows` records (from all records, in parallel, when 0).
+  void init_columns() {
+    const char* end = file_.end();
+    vector<Field> fields;
+    std::deque<string> scratch;
+    while (is_blank_record(data_, end))
+      data_ = read_record(data_, end, opts_.delim, opts_.quote, fields, scratch);
+    str_vec header;
+    if (opts_.header && data_ < end) {
+      data_ = read_record(data_, end, opts_.delim, opts_.quote, fields, scratch);
+      for (const auto& f : fields)
+        header.push_back(string(f.p, f.n));
+    }
+
+    // first records determine the number of fields and the block size
+    const char* p = data_;
+    size_t nrows = 0, nfields = header.size();
+    vector<Type> guessed;
+    size_t guess_rows = opts_.guess_rows > 0 ? opts_.guess_rows : 1000;
+    while (p < end && nrows < guess_rows) {
+      if (is_blank_record(p, end)) {
+        p = read_record(p, end, opts_.delim, opts_.quote, fields, scratch);
+        continue;
+      }
+      p = read_record(p, end, opts_.delim, opts_.quote, fields, scratch);
+      nfields = std::max(nfields, fields.size());
+      guessed.resize(nfields, NIL);
+      for (size_t c = 0; c < fields.size(); c++)
+        if (!is_na(fields[c]))
+          guessed[c] = wider_type(guessed[c], guess_type(fields[c], opts_.decimal));
+      nrows++;
+    }
+    if (opts_.col_names.size() > 0)
+      nfields = opts_.col_names.size();
+    else if (opts_.col_types.size() > 0)
+      nfields = opts_.col_types.size();
+    if (nfields == 0)
+      throw JamException("No columns in the input");
+    guessed.resize(nfields, NIL);
+    if (nrows > 0) {
+      double row_bytes = (double) (p - data_) / nrows;
+      // blocks end at the first record boundary past block_bytes_
+      block_bytes_ = std::max<size_t>(1, (size_t) (row_bytes * opts_.chunk_rows));
+    }
+
+    if (opts_.guess_rows == 0 && opts_.col_types.empty())
+      guessed = guess_all(nfields);
+
+    types_.assign(nfields, NIL);
+    for (size_t c = 0; c < nfields; c++) {
+      char t = c < opts_.col_types.size() ? opts_.col_types[c] : '?';
+      switch (t) {
+       case 'i': types_[c] = INT; break;
+       case 'd': types_[c] = DOUBLE; break;
+       case 'c': types_[c] = STRING; break;
+       case '_': case '-': types_[c] = NIL; break;
+       case '?': types_[c] = guessed[c] == NIL ? STRING : guessed[c]; break;
+       default:
+         throw JamException(string("Unknown column type '") + t + "'; use one of 'icd?_'");
+      }
+      if (types_[c] != NIL) {
+        if (c < opts_.col_names.size())
+          names_.push_back(opts_.col_names[c]);
+        else if (c < header.size())
+          names_.push_back(header[c]);
+        else
+          names_.push_back("X" + std::to_string(c + 1));
+      }
+    }
+  }
+
+  // Guess types from all records, one block per thread at a time
+  vector<Type> guess_all(size_t nfields) {
+    StatsTimer timer(stats.encode_time);
+    size_t nthreads = std::max<size_t>(opts_.threads, 1);
+    vector<Type> out(nfields, NIL);
+    const char* p = data_;
+    const char* end = file_.end();
+    while (p < end) {
+      vector<std::pair<const char*, const char*>> blocks;
+      // guessing produces no chunks; keep blocks large
+      size_t nbytes = std::max<size_t>(block_bytes_, 1 << 20);
+      while (blocks.size() < nthreads && p < end) {
+        const char* q = record_boundary(p, p + std::min<size_t>(nbytes, end - p), end, opts_.quote);
+        blocks.emplace_back(p, q);
+        p = q;
+      }
+      vector<vector<Type>> guessed(blocks.size(), vector<Type>(nfields, NIL));
+      Workers workers;
+      for (size_t b = 0; b < blocks.size(); b++) {
+        workers.emplace_back([&, b]() {
+            vector<Field> fields;
+            std::deque<string> scratch;
+            const char* r = blocks[b].first;
+            while (r < blocks[b].second) {
+              r = read_record(r, blocks[b].second, opts_.delim, opts_.quote, fields, scratch);
+              for (size_t c = 0; c < fields.size() && c < nfields; c++)
+                if (guessed[b][c] != STRING && !is_na(fields[c]))
+                  guessed[b][c] = wider_type(guessed[b][c], guess_type(fields[c], opts_.decimal));
+            }
+          });
+      }
+      workers.join();
+      for (const auto& g : guessed)
+        for (size_t c = 0; c < nfields; c++)
+          out[c] = wider_type(out[c], g[c]);
+    }
+    return out;
+  }
+
+  // Runs in a worker thread
+  void parse_block(Block& block) {
+    try {
+      vector<Field> fields;
+      std::deque<string> scratch;
+      block.cols = empty_columns();
+      vector<VarColl*> cols(types_.size(), nullptr);
+      for (size_t c = 0, j = 0; c < types_.size(); c++)
+        if (types_[c] != NIL)
+          cols[c] = &block.cols[j++];
+      const char* p = block.begin;
+      while (p < block.end) {
+        if (is_blank_record(p, block.end)) {
+          p = read_record(p, block.end, opts_.delim, opts_.quote, fields, scratch);
+          continue;
+        }
+        const char* record = p;
+        p = read_record(p, block.end, opts_.delim, opts_.quote, fields, scratch);
+        if (fields.size() != types_.size())
+          block.problems++;
+        for (size_t c = 0; c < types_.size(); c++) {
+          if (!cols[c]) continue;
+          Field f = c < fields.size() ? fields[c] : Field{"", 0};
+          bool na = is_na(f);
+          switch (types_[c]) {
+           case INT: {
+             int x = NA_INT;
+             if (!na && !parse_int(f, x))
+               throw_on_field(record, f, "an integer");
+             cols[c]->int_vec_val.push_back(x);
+             break;
+           }
+           case DOUBLE: {
+             double x = NAN;
+             if (!na && !parse_double(f, x, opts_.decimal))
+               throw_on_field(record, f, "a number");
+             cols[c]->dbl_vec_val.push_back(x);
+             break;
+           }
+           default:
+             // NAs are stored as "NA", as by jar()
+             if (na) cols[c]->str_vec_val.push_back("NA");
+             else cols[c]->str_vec_val.push_back(string(f.p, f.n));
+          }
+        }
+        block.nrows++;
+      }
+    } catch (std::exception& e) {
+      block.error = e.what();
+    }
+  }
+
+  void throw_on_field(const char* record, const Field& f, const string& what) const {
+    throw JamException("Field '" + string(f.p, std::min<size_t>(f.n, 50)) + "' of the record at byte " +
+                       std::to_string(record - file_.begin()) + " is not " + what +
+                       "; supply col_types or guess types from all rows");
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,63 @@
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "rutils.hpp"
+
+// Reading of partitioned datasets. Files are decoded concurrently, each
+// through its own Reader; R objects are built on the R thread afterwards.
+// Files are processed in batches to bound open handles and decoded data.
+
+// [[Rcpp::export]]
+List c_unjar_files(std::vector<std::string> paths, int threads, List filter) {
+
+  size_t nfiles = paths.size();
+  size_t batch = std::max<size_t>(64, 4 * threads);
+  List out(nfiles);
+  Stats stats;
+
+  for (size_t start = 0; start < nfiles; start += batch) {
+    size_t end = std::min(nfiles, start + batch);
+
+    vector<std::unique_ptr<Reader>> readers;
+    for (size_t i = start; i < end; i++) {
+      readers.emplace_back(new Reader(paths[i]));
+      init_filter(*readers.back(), filter);
+    }
+
+    std::atomic<size_t> next_file(0);
+    vector<string> errors(readers.size());
+    auto worker = [&]() {
+      size_t i;
+      while ((i = next_file++) < readers.size()) {
+        try {
+          readers[i]->read_columns();
+        } catch (std::exception& e) {
+          errors[i] = e.what();
+        }
+      }
+    };
+
+    vector<std::thread> pool;
+    for (int t = 1; t < threads && (size_t) t < readers.size(); t++)
+      pool.emplace_back(worker);
+    worker();
+    for (auto& th : pool)
+      th.join();
+
+    for (size_t i = 0; i < readers.size(); i++) {
+      if (!errors[i].empty())
+        stop("%s: %s", paths[start + i].c_str(), errors[i].c_str());
+      Reader& reader = *readers[i];
+      SEXP df = columns_df(reader);
+      if (df == R_NilValue)
+        df = empty_df(reader);
+      out[start + i] = df;
+      stats.merge(reader.stats);
+      readers[i].reset();
+    }
+  }
+
+  last_stats = stats;
+  return out;
+}
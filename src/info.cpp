@@ -0,0 +1,301 @@
+#include "rutils.hpp"
+
+// Inspection of archives without decoding data. For jam files heads, meta
+// names and length prefixes are read and data tails are skipped by seeking.
+// For jar files only the base header and the chunk index are read.
+
+List info_sexp(JamIArchive& bin, const Head& head, std::streamoff start);
+
+inline std::streamoff info_tell(JamIArchive& bin) {
+  return stream_pos(bin.stream.rdbuf());
+}
+
+inline void info_skip(JamIArchive& bin, ulong nbytes) {
+  bin.stream.rdbuf()->pubseekoff(nbytes, std::ios::cur, std::ios::in);
+}
+
+inline ulong info_size_tag(JamIArchive& bin) {
+  cereal::size_type n;
+  bin(cereal::make_size_tag(n));
+  return n;
+}
+
+// Skip alignment padding of buffers of aligned VECTORs
+inline void info_skip_padding(JamIArchive& bin) {
+  if (bin.aligned) {
+    ubyte npad;
+    bin(npad);
+    info_skip(bin, npad);
+  }
+}
+
+// Skip cereal vector of fixed size elements. Return its length.
+inline ulong info_skip_vector(JamIArchive& bin, size_t el_size) {
+  info_skip_padding(bin);
+  ulong n = info_size_tag(bin);
+  info_skip(bin, n * el_size);
+  return n;
+}
+
+std::string r_type_name(const Head& head) {
+  switch (head.coll_type) {
+   case NIL:  return "NULL";
+   case REF:  return "reference";
+   case META:
+   case LIST: return "list";
+   case VECTOR:
+     switch (head.el_type) {
+      case BOOL:   return "logical";
+      case FLOAT:
+      case DOUBLE:
+      case LONG:
+      case ULONG:  return "double";
+      case UTF8:
+      case STRING: return "character";
+      default:     return "integer";
+     }
+   default:
+     return Type2String(head.coll_type);
+  }
+}
+
+// Skip VECTOR tail and return its length.
+ulong info_skip_vector_tail(JamIArchive& bin, const Head& head) {
+  bin.aligned = head.aligned();
+  switch (head.el_type) {
+   case BOOL:
+     {
+       info_skip_padding(bin);
+       ulong n = info_size_tag(bin);
+       if (n == 0) return 0;
+       info_skip(bin, n - 1);
+       ubyte last;
+       bin(last);
+       return ((last & 12) == 12) ? n*2 - 1 : n*2;
+     }
+   case STRING:
+     {
+       info_skip_padding(bin);
+       ulong n = info_size_tag(bin);
+       for (ulong i = 0; i < n; i++)
+         info_skip(bin, info_size_tag(bin));
+       return n;
+     }
+   case UTF8:
+     {
+       Head nchar_head;
+       bin(nchar_head);
+       ulong n = info_skip_vector(bin, type_size(nchar_head.el_type));
+       info_skip_vector(bin, 1);
+       return n;
+     }
+   default:
+     return info_skip_vector(bin, type_size(head.el_type));
+  }
+}
+
+void skip_sexp(JamIArchive& bin, const Head& head) {
+  if (head.coll_type == REF) {
+    info_skip(bin, sizeof(ulong));
+    return;
+  }
+  if (head.metabit()) {
+    std::vector<std::string> names;
+    bin(names);
+    uint N;
+    bin(N);
+    for (uint i = 0; i < N; i++) {
+      Head el_head;
+      bin(el_head);
+      skip_sexp(bin, el_head);
+    }
+  }
+  switch (head.coll_type) {
+   case NIL:
+     break;
+   case VECTOR:
+     info_skip_vector_tail(bin, head);
+     if (head.crcbit())
+       info_skip(bin, sizeof(uint));
+     break;
+   case META:
+   case LIST:
+     {
+       R_xlen_t N = unjam_list_length(bin, head);
+       if (N > 0 && head.el_type == VECTOR) {
+         Head common_head;
+         bin(common_head);
+         for (R_xlen_t i = 0; i < N; i++)
+           skip_sexp(bin, common_head);
+       } else {
+         for (R_xlen_t i = 0; i < N; i++) {
+           Head el_head;
+           bin(el_head);
+           skip_sexp(bin, el_head);
+         }
+       }
+     }
+     break;
+   default:
+     stop("Unsupported jam::Type in the header (%s).", Type2String(head.coll_type));
+  }
+  if (head.coll_type != NIL)
+    unjam_number(bin, R_UnboundValue);
+}
+
+List info_meta(JamIArchive& bin) {
+  std::vector<std::string> names;
+  bin(names);
+  uint N;
+  bin(N);
+  List out(N);
+  for (uint i = 0; i < N; i++) {
+    std::streamoff start = info_tell(bin);
+    Head head;
+    bin(head);
+    out[i] = info_sexp(bin, head, start);
+  }
+  if (names.size() == N)
+    out.attr("names") = wrap(names);
+  return out;
+}
+
+List info_list_tail(JamIArchive& bin, const Head& head) {
+  R_xlen_t N = unjam_list_length(bin, head);
+  List out(N);
+  if (N > 0) {
+    switch (head.el_type) {
+     case MIXED:
+       for (R_xlen_t i = 0; i < N; i++) {
+         std::streamoff start = info_tell(bin);
+         Head el_head;
+         bin(el_head);
+         out[i] = info_sexp(bin, el_head, start);
+       }
+       break;
+     case VECTOR:
+       {
+         Head common_head;
+         bin(common_head);
+         for (R_xlen_t i = 0; i < N; i++)
+           out[i] = info_sexp(bin, common_head, info_tell(bin));
+       }
+       break;
+     default:
+       stop("Element type of LISTs can only be VECTOR or MIXED.");
+    }
+  }
+  return out;
+}
+
+// Describe the object whose head has been read. `start` is the position of
+// the head (or of the tail for elements of uniform lists).
+List info_sexp(JamIArchive& bin, const Head& head, std::streamoff start) {
+
+  SEXP attributes = R_NilValue;
+  if (head.metabit())
+    attributes = info_meta(bin);
+  PROTECT(attributes);
+
+  double length = 0;
+  SEXP elements = R_NilValue;
+
+  switch (head.coll_type) {
+   case NIL:
+     break;
+   case REF:
+     {
+       // length is the number of the referenced object
+       ulong id;
+       bin(id);
+       length = id;
+     }
+     break;
+   case VECTOR:
+     length = info_skip_vector_tail(bin, head);
+     if (head.crcbit())
+       info_skip(bin, sizeof(uint));
+     break;
+   case META:
+   case LIST:
+     elements = info_list_tail(bin, head);
+     length = XLENGTH(elements);
+     break;
+   default:
+     stop("Unsupported jam::Type in the header (%s).", Type2String(head.coll_type));
+  }
+  PROTECT(elements);
+
+  List out = List::create(Named("type") = r_type_name(head),
+                          Named("encoding") = Type2String(head.coll_type == VECTOR ? head.el_type : head.coll_type),
+                          Named("length") = length,
+                          Named("bytes") = (double) (info_tell(bin) - start),
+                          Named("checksum") = head.crcbit(),
+                          Named("aligned") = head.aligned(),
+                          Named("attributes") = attributes,
+                          Named("elements") = elements);
+  UNPROTECT(2);
+  return out;
+}
+
+// [[Rcpp::export]]
+SEXP c_jam_info(const std::string& path) {
+  std::ifstream fin(path, std::ios::binary);
+  JamIArchive bin(fin);
+  Head head;
+  bin(head);
+  return info_sexp(bin, head, 0);
+}
+
+// [[Rcpp::export]]
+SEXP c_jar_info(const std::string& path) {
+  Reader reader(path);
+  Description desc = reader.describe();
+  const Index& index = desc.index;
+  size_t ncols = desc.col_metas.size();
+  size_t nchunks = index.chunks.size();
+
+  CharacterVector names(ncols), types(ncols), classes(ncols);
+  LogicalVector lists(ncols);
+  for (size_t c = 0; c < ncols; c++) {
+    lists[c] = index.coll_type(c) == LIST;
+    if (c < desc.names.size())
+      names[c] = desc.names[c];
+    Type type = c < desc.col_types.size() ? desc.col_types[c] : UNDEFINED;
+    types[c] = Type2String(type);
+    auto cls = desc.col_metas[c].find("class");
+    if (cls != desc.col_metas[c].end() && cls->second.el_type == STRING && cls->second.size() > 0)
+      classes[c] = cls->second.str_vec_val[0];
+    else if (lists[c])
+      classes[c] = "list";
+    else
+      classes[c] = r_type_name(Head(VECTOR, type));
+  }
+
+  NumericVector offsets(nchunks), bytes(nchunks), rows(nchunks);
+  for (size_t i = 0; i < nchunks; i++) {
+    offsets[i] = index.chunks[i].offset;
+    bytes[i] = index.chunks[i].nbytes;
+    rows[i] = index.chunks[i].nrows;
+  }
+
+  CharacterVector attributes;
+  for (const auto& kv : desc.meta)
+    attributes.push_back(kv.first);
+
+  return List::create(Named("nrows") = (double) index.nrows(),
+                      Named("ncols") = (double) ncols,
+                      Named("nchunks") = (double) nchunks,
+                      Named("file_size") = (double) desc.file_size,
+                      Named("indexed") = desc.indexed,
+                      Named("checksums") = index.has_crc,
+                      Named("attributes") = attributes,
+                      Named("columns") = DataFrame::create(Named("name") = names,
+                                                           Named("type") = types,
+                                                           Named("class") = classes,
+                                                           Named("list") = lists,
+                                                           Named("stringsAsFactors") = false),
+                      Named("chunks") = DataFrame::create(Named("offset") = offsets,
+                                                          Named("bytes") = bytes,
+                                                          Named("rows") = rows));
+}
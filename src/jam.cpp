@@ -1,19 +1,37 @@
 #include "rutils.hpp"
 
 // LAYOUT:
-// HOBJ   =  HEAD OBJ                   : object with head 
+// HOBJ   =  HEAD OBJ | REF             : object with head 
+// REF    =  HEAD ID                    : repeated object  REF:UNDEFINED
 // OBJ    =  VECTOR | MLIST | ULIST     : object (no head, aka tail object)
 // VECTOR = [META] DATA                 : vector type  VECTOR:eltype
 // MLIST  = [META] N HOBJ...            : mixed list   LIST:MIXED
 // ULIST  = [META] N COMMON_HEAD OBJ... : uniform list LIST:VECTOR
 // META   =  NAMES N HOBJ...            : meta (cannot hold meta itself)
+//
+// With checksums VECTOR heads have the crc bit set and DATA is followed by
+// CRC32C of DATA.
+//
+// N of lists is 32-bit; lists longer than that have the long bit set in
+// their head and a 64-bit N. Vector lengths are always 64-bit.
+//
+// Aligned archives have version JAM_VERSION_ALIGNED in VECTOR heads and each
+// cereal vector in DATA is preceded by padding, such that its elements start
+// on a 64-byte boundary (see jam.hpp).
+//
+// Deduplicated archives have the ref bit set in the root head. Their non-NIL
+// objects are numbered in the order their writing completes (attributes
+// before their object, elements before their list) and an object which
+// repeats an earlier one is written as a REF holding the 64-bit number ID of
+// the first occurrence. As elements of ULISTs have no heads, lists with
+// repeated elements are written as MLISTs.
 
-void jam_meta(cereal::BinaryOutputArchive& bout, SEXP x);
-void jam_sexp(cereal::BinaryOutputArchive& bout, SEXP x, bool with_head = true);
-void jam_sexp(cereal::BinaryOutputArchive& bout, SEXP x, bool with_head, Head& head);
+void jam_meta(JamOArchive& bout, SEXP x);
+void jam_sexp(JamOArchive& bout, SEXP x, bool with_head = true);
+void jam_sexp(JamOArchive& bout, SEXP x, bool with_head, Head& head);
 
 
-void jam_meta(cereal::BinaryOutputArchive& bout, SEXP x) {
+void jam_meta(JamOArchive& bout, SEXP x) {
   PRINT(">META\n");
   std::vector<std::string> names;
   std::vector<int> ixs;
@@ -49,42 +67,89 @@ void jam_meta(cereal::BinaryOutputArchive& bout, SEXP x) {
   PRINT("<META\n");
 }
 
+// Pad the stream such that data of the following buffer is aligned
+void jam_padding(JamOArchive& bout) {
+  if (bout.aligned) {
+    static const char zeros[JAM_ALIGNMENT] = {};
+    ubyte npad = align_padding(bout.stream.tellp());
+    bout(npad);
+    bout.stream.write(zeros, npad);
+  }
+}
+
+// Tail writers return the number of written bytes.
+
 template<typename Tout, typename Tin>
-void jam_vector_tail (cereal::BinaryOutputArchive& bout, Tin* x, const size_t& N) {
-  std::vector<Tout> out(x, x + N);
+size_t jam_vector_tail (JamOArchive& bout, Tin* x, const size_t& N) {
+  std::vector<Tout> out;
+  {
+    StatsTimer timer(bout.stats.encode_time);
+    out.assign(x, x + N);
+  }
+  StatsTimer timer(bout.stats.io_time);
+  jam_padding(bout);
+  bout(out);
+  return sizeof(cereal::size_type) + N * sizeof(Tout);
+}
+
+template<typename Tout>
+size_t jam_int_vector_tail (JamOArchive& bout, int* x, const size_t& N, const Tout& na_val) {
+  std::vector<Tout> out(N);
+  {
+    StatsTimer timer(bout.stats.encode_time);
+    for (size_t i = 0; i < N; i++) {
+      int xi = x[i];
+      if (xi == NA_INTEGER) out[i] = na_val;
+      else out[i] = static_cast<Tout>(xi);
+    }
+  }
+  StatsTimer timer(bout.stats.io_time);
+  jam_padding(bout);
   bout(out);
+  return sizeof(cereal::size_type) + N * sizeof(Tout);
 }
 
 template<typename Tout>
-void jam_int_vector_tail (cereal::BinaryOutputArchive& bout, int* x, const size_t& N, const Tout& na_val) {
+size_t jam_long_vector_tail (JamOArchive& bout, int64_t* x, const size_t& N, const Tout& na_val) {
   std::vector<Tout> out(N);
-  for (size_t i = 0; i < N; i++) {
-    int xi = x[i];
-    if (xi == NA_INTEGER) out[i] = na_val;
-    else out[i] = static_cast<Tout>(xi);
+  {
+    StatsTimer timer(bout.stats.encode_time);
+    for (size_t i = 0; i < N; i++) {
+      int64_t xi = x[i];
+      if (xi == NA_LONG) out[i] = na_val;
+      else out[i] = static_cast<Tout>(xi);
+    }
   }
+  StatsTimer timer(bout.stats.io_time);
+  jam_padding(bout);
   bout(out);
+  return sizeof(cereal::size_type) + N * sizeof(Tout);
 }
 
-void jam_bool_vector_tail (cereal::BinaryOutputArchive& bout, int* x, const size_t& N) {
+size_t jam_bool_vector_tail (JamOArchive& bout, int* x, const size_t& N) {
   size_t n = (N + 1)/2;
   std::vector<ubyte> bytes(n);
-  size_t i;
-  for (i = 0; i < N; i += 2) {
-    ubyte b1 = (x[i] == NA_INTEGER) ? 2 : (x[i] ? 1 : 0);     // 0010, 0001 or 0000
-    ubyte b2 = (x[i+1] == NA_INTEGER) ? 8 : (x[i+1] ? 4 : 0); // 1000, 0100 or 0000      
-    bytes[i/2] = (b1 | b2);
-  }
-  if (N % 2) {
-    // set last odd element separately
-    bytes[n-1] = (x[N-1] == NA_INTEGER) ? 14 : (x[N-1] ? 13 : 12); // 1110, 1101 or 1100
+  {
+    StatsTimer timer(bout.stats.encode_time);
+    for (size_t i = 0; i + 1 < N; i += 2) {
+      ubyte b1 = (x[i] == NA_INTEGER) ? 2 : (x[i] ? 1 : 0);     // 0010, 0001 or 0000
+      ubyte b2 = (x[i+1] == NA_INTEGER) ? 8 : (x[i+1] ? 4 : 0); // 1000, 0100 or 0000      
+      bytes[i/2] = (b1 | b2);
+    }
+    if (N % 2) {
+      // set last odd element separately
+      bytes[n-1] = (x[N-1] == NA_INTEGER) ? 14 : (x[N-1] ? 13 : 12); // 1110, 1101 or 1100
+    }
   }
+  StatsTimer timer(bout.stats.io_time);
+  jam_padding(bout);
   bout(bytes);
+  return sizeof(cereal::size_type) + n;
 }
 
 // HEAD_LEN_TYPE|NCHARS...|UTF8...
-void jam_utf8_vector_tail (cereal::BinaryOutputArchive& bout, SEXP x) {
-  uint N = LENGTH(x);
+size_t jam_utf8_vector_tail (JamOArchive& bout, SEXP x) {
+  R_xlen_t N = XLENGTH(x);
 
   std::vector<uint8_t> data;
   size_t data_len = 0;
@@ -92,62 +157,90 @@ void jam_utf8_vector_tail (cereal::BinaryOutputArchive& bout, SEXP x) {
   std::vector<int> nchars(N);
   int max_nchars = 0;
   
-  for (int i = 0; i < N; i++) {
-    SEXP str = STRING_ELT(x, i);
-    if (str == R_NaString) {
-      nchars[i] = -1;
-    } else  if (str == R_BlankString) {
-      nchars[i] = 0;
-    } else {
-      const char* ch = Rf_translateCharUTF8(str);
-      int len = strlen(ch);
-      nchars[i] = len;
-      data_len += len;
-      max_nchars = std::max(len, max_nchars);
-      std::copy(&ch[0], &ch[len], std::inserter(data, data.end()));
+  {
+    StatsTimer timer(bout.stats.encode_time);
+    for (R_xlen_t i = 0; i < N; i++) {
+      SEXP str = STRING_ELT(x, i);
+      if (str == R_NaString) {
+        nchars[i] = -1;
+      } else  if (str == R_BlankString) {
+        nchars[i] = 0;
+      } else {
+        const char* ch = Rf_translateCharUTF8(str);
+        int len = strlen(ch);
+        nchars[i] = len;
+        data_len += len;
+        max_nchars = std::max(len, max_nchars);
+        data.insert(data.end(), ch, ch + len);
+      }
     }
   }
 
   Head head = Head(VECTOR, INT, false);
+  size_t nbytes = 4 + 2*sizeof(cereal::size_type) + data_len;
   
+  StatsTimer timer(bout.stats.io_time);
   if (max_nchars >= MAX_SHORT) {
     bout(head);
+    jam_padding(bout);
     bout(nchars);
+    nbytes += N * sizeof(int);
   } else if (max_nchars >= MAX_BYTE) {
     std::vector<short> tnchars(nchars.begin(), nchars.end());
     head.el_type = SHORT;
     bout(head);
+    jam_padding(bout);
     bout(tnchars);
+    nbytes += N * sizeof(short);
   } else {
     std::vector<byte> tnchars(nchars.begin(), nchars.end());
     head.el_type = BYTE;
     bout(head);
+    jam_padding(bout);
     bout(tnchars);
+    nbytes += N;
   }
 
+  jam_padding(bout);
   bout(data);
+  return nbytes;
 }
 
-void jam_string_vector_tail(cereal::BinaryOutputArchive& bout, SEXP x) {
-  bout(as<std::vector<std::string>>(x));
+size_t jam_string_vector_tail(JamOArchive& bout, SEXP x) {
+  std::vector<std::string> out;
+  {
+    StatsTimer timer(bout.stats.encode_time);
+    out = as<std::vector<std::string>>(x);
+  }
+  size_t nbytes = sizeof(cereal::size_type);
+  for (const auto& str : out)
+    nbytes += sizeof(cereal::size_type) + str.size();
+  StatsTimer timer(bout.stats.io_time);
+  jam_padding(bout);
+  bout(out);
+  return nbytes;
 }
 
-void jam_list_tail(cereal::BinaryOutputArchive& bout, SEXP x, Head& head) {
-  uint N = LENGTH(x); // max list size is uint max element
-  bout(N);
+void jam_list_tail(JamOArchive& bout, SEXP x, Head& head) {
+  R_xlen_t N = XLENGTH(x);
+  jam_list_length(bout, head, N);
   if (N != 0) {
     switch (head.el_type) {
      case VECTOR:
        {
          Head common_head = get_head(VECTOR_ELT(x, 0));
+         if (bout.crcbuf && common_head.coll_type == VECTOR)
+           common_head.crcbit(true);
+         if (bout.aligned && common_head.coll_type == VECTOR)
+           common_head.version(JAM_VERSION_ALIGNED);
          bout(common_head);
-         for (uint i = 0; i < N; i++) {
+         for (R_xlen_t i = 0; i < N; i++) {
            jam_sexp(bout, VECTOR_ELT(x, i), false, common_head);
          }
        }
        break;
      case MIXED:
-       for (size_t i = 0; i < N; i++) {
+       for (R_xlen_t i = 0; i < N; i++) {
          jam_sexp(bout, VECTOR_ELT(x, i), true);
        }
        break;
@@ -156,26 +249,130 @@ void jam_list_tail(cereal::BinaryOutputArchive& bout, SEXP x, Head& head) {
   }
 }
 
-void jam_sexp(cereal::BinaryOutputArchive& bout, SEXP x, bool with_head) {
+// Hash of type, length and data of atomic vectors for DEDUP_CONTENT. Strings
+// are hashed by their CHARSXP pointers, which R caches.
+uint content_hash(SEXP x) {
+  R_xlen_t N = XLENGTH(x);
+  uint h = crc32c(&N, sizeof(N), TYPEOF(x));
+  switch (TYPEOF(x)) {
+   case LGLSXP:  return crc32c(LOGICAL(x), N * sizeof(int), h);
+   case INTSXP:  return crc32c(INTEGER(x), N * sizeof(int), h);
+   case REALSXP: return crc32c(REAL(x), N * sizeof(double), h);
+   case STRSXP:
+     for (R_xlen_t i = 0; i < N; i++) {
+       SEXP el = STRING_ELT(x, i);
+       h = crc32c(&el, sizeof(SEXP), h);
+     }
+     return h;
+   default:
+     stop("Should not happen. Please report.");
+  }
+}
+
+inline bool dedup_content(const JamOArchive& bout, SEXP x) {
+  if (bout.dedup != DEDUP_CONTENT) return false;
+  SEXPTYPE type = TYPEOF(x);
+  return type == LGLSXP || type == INTSXP || type == REALSXP || type == STRSXP;
+}
+
+// Number of the earlier object which `x` repeats or -1
+long find_ref(JamOArchive& bout, SEXP x) {
+  if (bout.dedup == DEDUP_NONE || TYPEOF(x) == NILSXP)
+    return -1;
+  auto it = bout.ref_ids.find(x);
+  if (it != bout.ref_ids.end())
+    return it->second;
+  if (dedup_content(bout, x)) {
+    auto range = bout.ref_hashes.equal_range(content_hash(x));
+    for (auto r = range.first; r != range.second; ++r) {
+      // bitwise equal doubles, distinct NA and NaN
+      if (R_compute_identical(x, r->second, 3))
+        return bout.ref_ids[r->second];
+    }
+  }
+  return -1;
+}
+
+// Number `x` once it has been written
+void jam_number(JamOArchive& bout, SEXP x) {
+  if (bout.dedup == DEDUP_NONE || TYPEOF(x) == NILSXP)
+    return;
+  bout.ref_ids.emplace(x, bout.nrefs++);
+  if (dedup_content(bout, x))
+    bout.ref_hashes.emplace(content_hash(x), x);
+}
+
+// Write REF record if `x` repeats an earlier object
+bool jam_ref(JamOArchive& bout, SEXP x) {
+  long id = find_ref(bout, x);
+  if (id < 0)
+    return false;
+  Head head(REF, UNDEFINED);
+  bout(head, static_cast<ulong>(id));
+  bout.stats.add(REF, 1, sizeof(ulong));
+  return true;
+}
+
+bool has_repeated_elements(JamOArchive& bout, SEXP x) {
+  std::unordered_set<SEXP> seen;
+  std::unordered_set<uint> hashes;
+  for (R_xlen_t i = 0; i < XLENGTH(x); i++) {
+    SEXP el = VECTOR_ELT(x, i);
+    if (TYPEOF(el) == NILSXP)
+      continue;
+    if (!seen.insert(el).second || find_ref(bout, el) >= 0)
+      return true;
+    // hash collisions only cost the ULIST layout
+    if (dedup_content(bout, el) && !hashes.insert(content_hash(el)).second)
+      return true;
+  }
+  return false;
+}
+
+Head jam_head(JamOArchive& bout, SEXP x, bool with_head) {
   Head head = get_head(x);
-  if (with_head && TYPEOF(x) == INTSXP) {
+  if (bout.aligned) {
+    // aligned archives keep native types such that vectors can be viewed in
+    // place (ULIST elements of integer64 vectors stay raw DOUBLEs)
+    if (with_head && is_integer64(x))
+      head.el_type = LONG;
+  } else if (with_head && TYPEOF(x) == INTSXP) {
     // FIXME: ULISTs of int vectors don't use this optimization
     head.el_type = best_int_type(x);
+  } else if (with_head && is_integer64(x)) {
+    // elements of ULISTs stay raw DOUBLEs, which unjam reads back as such
+    head.el_type = best_long_type(x);
   }
+  if (bout.crcbuf && head.coll_type == VECTOR)
+    head.crcbit(true);
+  if (bout.aligned && head.coll_type == VECTOR)
+    head.version(JAM_VERSION_ALIGNED);
+  if (bout.dedup != DEDUP_NONE && head.coll_type == LIST && head.el_type == VECTOR &&
+      has_repeated_elements(bout, x))
+    head.el_type = MIXED;
+  return head;
+}
+
+void jam_sexp(JamOArchive& bout, SEXP x, bool with_head) {
+  if (with_head && jam_ref(bout, x))
+    return;
+  Head head = jam_head(bout, x, with_head);
   jam_sexp(bout, x, with_head, head);
 }
 
 
-void jam_sexp(cereal::BinaryOutputArchive& bout, SEXP x, bool with_head, Head& head) {
+void jam_sexp(JamOArchive& bout, SEXP x, bool with_head, Head& head) {
 #ifdef DEBUG
   head.print("jam_sexp:");
 #endif
   
   size_t N = XLENGTH(x);
   Type jtype = head.el_type;
+  size_t nbytes = 0;
 
   if (with_head) bout(head);
   if (head.metabit()) jam_meta(bout, x);
+  if (head.crcbit()) bout.crcbuf->reset();
  
   switch (TYPEOF(x)) {
 
@@ -185,13 +382,13 @@ void jam_sexp(cereal::BinaryOutputArchive& bout, SEXP x, bool with_head, Head& h
    case LGLSXP:
      switch (jtype) {
       case BOOL:
-        jam_bool_vector_tail(bout, LOGICAL(x), N);
+        nbytes = jam_bool_vector_tail(bout, LOGICAL(x), N);
         break;
       case BYTE:
-        jam_int_vector_tail<byte>(bout, LOGICAL(x), N, NA_BYTE);
+        nbytes = jam_int_vector_tail<byte>(bout, LOGICAL(x), N, NA_BYTE);
         break;
       case UBYTE:
-        jam_int_vector_tail<ubyte>(bout, LOGICAL(x), N, NA_UBYTE);
+        nbytes = jam_int_vector_tail<ubyte>(bout, LOGICAL(x), N, NA_UBYTE);
         break;
       default:
         stop_on_invalid_type(x, jtype);
@@ -202,22 +399,22 @@ void jam_sexp(cereal::BinaryOutputArchive& bout, SEXP x, bool with_head, Head& h
 
      switch (jtype) {
       case BYTE:
-        jam_int_vector_tail<byte>(bout, INTEGER(x), N, NA_BYTE);
+        nbytes = jam_int_vector_tail<byte>(bout, INTEGER(x), N, NA_BYTE);
         break;
       case UBYTE:
-        jam_int_vector_tail<ubyte>(bout, INTEGER(x), N, NA_UBYTE);
+        nbytes = jam_int_vector_tail<ubyte>(bout, INTEGER(x), N, NA_UBYTE);
         break;
       case SHORT:
-        jam_int_vector_tail<short>(bout, INTEGER(x), N, NA_SHORT);
+        nbytes = jam_int_vector_tail<short>(bout, INTEGER(x), N, NA_SHORT);
         break;
       case USHORT:
-        jam_int_vector_tail<ushort>(bout, INTEGER(x), N, NA_USHORT);
+        nbytes = jam_int_vector_tail<ushort>(bout, INTEGER(x), N, NA_USHORT);
         break;
       case INT:
-        jam_vector_tail<int>(bout, INTEGER(x), N);
+        nbytes = jam_vector_tail<int>(bout, INTEGER(x), N);
         break;
       case UINT:
-        jam_int_vector_tail<uint>(bout, INTEGER(x), N, NA_UINT);
+        nbytes = jam_int_vector_tail<uint>(bout, INTEGER(x), N, NA_UINT);
         break;
       default:
         stop_on_invalid_type(x, jtype);
@@ -226,11 +423,32 @@ void jam_sexp(cereal::BinaryOutputArchive& bout, SEXP x, bool with_head, Head& h
      
    case REALSXP:
      switch(jtype) {
+      case BYTE:
+        nbytes = jam_long_vector_tail<byte>(bout, INTEGER64(x), N, NA_BYTE);
+        break;
+      case UBYTE:
+        nbytes = jam_long_vector_tail<ubyte>(bout, INTEGER64(x), N, NA_UBYTE);
+        break;
+      case SHORT:
+        nbytes = jam_long_vector_tail<short>(bout, INTEGER64(x), N, NA_SHORT);
+        break;
+      case USHORT:
+        nbytes = jam_long_vector_tail<ushort>(bout, INTEGER64(x), N, NA_USHORT);
+        break;
+      case INT:
+        nbytes = jam_long_vector_tail<int>(bout, INTEGER64(x), N, NA_INT);
+        break;
+      case UINT:
+        nbytes = jam_long_vector_tail<uint>(bout, INTEGER64(x), N, NA_UINT);
+        break;
+      case LONG:
+        nbytes = jam_vector_tail<int64_t>(bout, INTEGER64(x), N);
+        break;
       case FLOAT:
-        jam_vector_tail<float>(bout, REAL(x), N);
+        nbytes = jam_vector_tail<float>(bout, REAL(x), N);
         break;
       case DOUBLE:
-        jam_vector_tail<double>(bout, REAL(x), N);
+        nbytes = jam_vector_tail<double>(bout, REAL(x), N);
         break;
       default:
         stop_on_invalid_type(x, jtype);
@@ -240,10 +458,10 @@ void jam_sexp(cereal::BinaryOutputArchive& bout, SEXP x, bool with_head, Head& h
    case STRSXP:
      switch(jtype) {
       case UTF8:
-        jam_utf8_vector_tail(bout, x);
+        nbytes = jam_utf8_vector_tail(bout, x);
         break;
       case STRING:
-        jam_string_vector_tail(bout, x);
+        nbytes = jam_string_vector_tail(bout, x);
         break;
       default:
         stop_on_invalid_type(x, jtype);
@@ -252,16 +470,52 @@ void jam_sexp(cereal::BinaryOutputArchive& bout, SEXP x, bool with_head, Head& h
      
    case VECSXP:
      jam_list_tail(bout, x, head);
-     break;
+     jam_number(bout, x);
+     return;
 
    default:
      stop("Cannot jam object of type %s", Rf_type2char(TYPEOF(x)));
   }
+
+  if (head.crcbit()) {
+    uint crc = bout.crcbuf->crc();
+    bout(crc);
+  }
+
+  bout.stats.objects++;
+  bout.stats.add(jtype, N, nbytes);
+  jam_number(bout, x);
 }
 
 // [[Rcpp::export]]
-void c_jam(SEXP x, const std::string path) {
+void c_jam(SEXP x, const std::string path, bool checksum = false, bool aligned = false,
+           int dedup = 0) {
   std::ofstream fout(path, std::ios::binary);
-  cereal::BinaryOutputArchive bout(fout);
-  jam_sexp(bout, x, true);
+  CrcOStreambuf crcbuf(fout.rdbuf());
+  std::ostream out(&crcbuf);
+  JamOArchive bout(checksum ? out : fout, checksum ? &crcbuf : nullptr);
+  bout.aligned = aligned;
+  bout.dedup = dedup;
+  Head head = jam_head(bout, x, true);
+  head.refbit(dedup != DEDUP_NONE);
+  jam_sexp(bout, x, true, head);
+  last_stats = bout.stats;
+}
+
+// [[Rcpp::export]]
+SEXP c_jam_stats() {
+  NumericVector bytes, elements;
+  for (size_t t = 0; t < 256; t++) {
+    if (last_stats.elements[t] > 0 || last_stats.bytes[t] > 0) {
+      string name = Type2String(static_cast<Type>(t));
+      bytes.push_back(static_cast<double>(last_stats.bytes[t]), name);
+      elements.push_back(static_cast<double>(last_stats.elements[t]), name);
+    }
+  }
+  return List::create(Named("bytes") = bytes,
+                      Named("elements") = elements,
+                      Named("objects") = static_cast<double>(last_stats.objects),
+                      Named("encode_time") = last_stats.encode_time,
+                      Named("io_time") = last_stats.io_time,
+                      Named("alloc_time") = last_stats.alloc_time);
 }
@@ -29,6 +29,24 @@
 #include <limits>
 #include <new> // for placement-new
 #include <algorithm>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <streambuf>
+#include <sstream>
+#include <cmath>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 #include <cereal/types/string.hpp>
 #include <cereal/types/vector.hpp>
@@ -51,12 +69,12 @@ template<class T>
 using strmap = std::map<std::string, T>;
 
 typedef vector<int> int_vec;
-typedef vector<long> long_vec;
+typedef vector<int64_t> long_vec;
 typedef vector<double> dbl_vec;
 typedef vector<string> str_vec;
 
 typedef strmap<int> int_map;
-typedef strmap<long> long_map;
+typedef strmap<int64_t> long_map;
 typedef strmap<double> dbl_map;
 typedef strmap<string> str_map;
 
@@ -75,7 +93,7 @@ const short  NA_SHORT = std::numeric_limits<short>::min();
 const ushort NA_USHORT = std::numeric_limits<ushort>::max();
 const int    NA_INT = std::numeric_limits<int>::min();
 const uint   NA_UINT = std::numeric_limits<uint>::max();
-const long   NA_LONG = std::numeric_limits<long>::min();
+const int64_t NA_LONG = std::numeric_limits<int64_t>::min();
 const ulong  NA_ULONG = std::numeric_limits<ulong>::max();
 
 const byte   MAX_BYTE = std::numeric_limits<byte>::max();
@@ -84,7 +102,7 @@ const short  MAX_SHORT = std::numeric_limits<short>::max();
 const ushort MAX_USHORT = std::numeric_limits<ushort>::max();
 const int    MAX_INT = std::numeric_limits<int>::max();
 const uint   MAX_UINT = std::numeric_limits<uint>::max();
-const long   MAX_LONG = std::numeric_limits<long>::max();
+const int64_t MAX_LONG = std::numeric_limits<int64_t>::max();
 const ulong  MAX_ULONG = std::numeric_limits<ulong>::max();
 
 const byte   MIN_BYTE = std::numeric_limits<byte>::min();
@@ -93,7 +111,7 @@ const short  MIN_SHORT = std::numeric_limits<short>::min();
 const ushort MIN_USHORT = std::numeric_limits<ushort>::min();
 const int    MIN_INT = std::numeric_limits<int>::min();
 const uint   MIN_UINT = std::numeric_limits<uint>::min();
-const long   MIN_LONG = std::numeric_limits<long>::min();
+const int64_t MIN_LONG = std::numeric_limits<int64_t>::min();
 const ulong  MIN_ULONG = std::numeric_limits<ulong>::min();
 
 const ulong  MAX_SIZE = std::numeric_limits<size_t>::max();
@@ -121,6 +139,9 @@ enum Type : ubyte {
   LIST   = 102,
   MAP    = 103,
   DF     = 104,
+  INDEX  = 105,
+  BLOOM  = 106,
+  REF    = 107, // back-reference to an earlier object of a jam archive
 
   UNSUPORTED = 254, 
   UNDEFINED  = 255
@@ -151,6 +172,9 @@ inline std::string Type2String(Type t) {
    case LIST:      return "LIST";
    case MAP:       return "MAP";
    case DF:        return "DF";
+   case INDEX:     return "INDEX";
+   case BLOOM:     return "BLOOM";
+   case REF:       return "REF";
 
    case UNSUPORTED: return "UNSUPORTED";
    case UNDEFINED:  return "UNDEFINED";
@@ -164,6 +188,272 @@ static inline void throw_on_invalid_type (const Type& type) {
 }
 
 
+/* ------------------------------------------------------ */
+/* STATISTICS                                             */
+/* ------------------------------------------------------ */
+
+// Counters collected by jam/unjam and by Reader/Writer. Updated once per
+// vector or chunk, never per element.
+struct Stats {
+  ulong bytes[256] = {};    // bytes written or read, by element type
+  ulong elements[256] = {}; // number of elements, by element type (encoding)
+  ulong objects = 0;        // number of jammed objects or jarred chunks
+  double encode_time = 0;   // seconds in type narrowing, packing, UTF-8 translation
+  double io_time = 0;       // seconds in archive/stream calls
+  double alloc_time = 0;    // seconds in allocation of R objects
+
+  void add(Type type, ulong nelements, ulong nbytes) {
+    elements[type] += nelements;
+    bytes[type] += nbytes;
+  }
+
+  void merge(const Stats& other) {
+    for (size_t i = 0; i < 256; i++) {
+      elements[i] += other.elements[i];
+      bytes[i] += other.bytes[i];
+    }
+    objects += other.objects;
+    encode_time += other.encode_time;
+    io_time += other.io_time;
+    alloc_time += other.alloc_time;
+  }
+
+  void reset() {
+    *this = Stats();
+  }
+};
+
+// Add elapsed time to a Stats field on destruction.
+class StatsTimer {
+  double& acc_;
+  std::chrono::steady_clock::time_point start_;
+ public:
+  StatsTimer(double& acc) : acc_(acc), start_(std::chrono::steady_clock::now()) {}
+  ~StatsTimer() {
+    acc_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+  }
+};
+
+
+/* ------------------------------------------------------ */
+/* CHECKSUMS                                              */
+/* ------------------------------------------------------ */
+
+// CRC32C (Castagnoli). Uses SSE4.2 crc32 instruction when the CPU supports it
+// and falls back to a table driven implementation otherwise. Checksums can be
+// extended: crc32c(b, nb, crc32c(a, na)) == crc32c(ab, na + nb).
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define JAM_CRC32C_HW
+#endif
+
+namespace detail {
+
+inline const uint* crc32c_table() {
+  static const vector<uint> table = [] {
+    vector<uint> t(256);
+    for (uint i = 0; i < 256; i++) {
+      uint c = i;
+      for (int k = 0; k < 8; k++)
+        c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+      t[i] = c;
+    }
+    return t;
+  }();
+  return table.data();
+}
+
+inline uint crc32c_sw(uint crc, const ubyte* p, size_t n) {
+  const uint* table = crc32c_table();
+  while (n--)
+    crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+#ifdef JAM_CRC32C_HW
+__attribute__((target("sse4.2")))
+inline uint crc32c_hw(uint crc, const ubyte* p, size_t n) {
+  ulong c = crc;
+  while (n >= 8) {
+    ulong v;
+    std::memcpy(&v, p, 8);
+    c = __builtin_ia32_crc32di(c, v);
+    p += 8;
+    n -= 8;
+  }
+  uint c32 = static_cast<uint>(c);
+  while (n--)
+    c32 = __builtin_ia32_crc32qi(c32, *p++);
+  return c32;
+}
+
+inline bool crc32c_hw_supported() {
+  static const bool supported = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2") != 0;
+  }();
+  return supported;
+}
+#endif
+
+}
+
+inline uint crc32c(const void* data, size_t n, uint crc = 0) {
+  const ubyte* p = static_cast<const ubyte*>(data);
+#ifdef JAM_CRC32C_HW
+  if (detail::crc32c_hw_supported())
+    return ~detail::crc32c_hw(~crc, p, n);
+#endif
+  return ~detail::crc32c_sw(~crc, p, n);
+}
+
+// Unbuffered stream buffers which forward to another buffer and checksum all
+// bytes passing through. Cereal binary archives go through sputn/sgetn only,
+// so the checksum is computed in the same pass as (de)serialization.
+
+class CrcOStreambuf : public std::streambuf {
+  std::streambuf* dest_;
+  uint crc_ = 0;
+ public:
+  CrcOStreambuf(std::streambuf* dest) : dest_(dest) {}
+  uint crc() const { return crc_; }
+  void reset() { crc_ = 0; }
+ protected:
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    std::streamsize out = dest_->sputn(s, n);
+    crc_ = crc32c(s, out, crc_);
+    return out;
+  }
+  int_type overflow(int_type ch) override {
+    if (traits_type::eq_int_type(ch, traits_type::eof()))
+      return traits_type::not_eof(ch);
+    char c = traits_type::to_char_type(ch);
+    return xsputn(&c, 1) == 1 ? ch : traits_type::eof();
+  }
+  pos_type seekoff(off_type off, std::ios::seekdir dir, std::ios::openmode mode) override {
+    return dest_->pubseekoff(off, dir, mode);
+  }
+  pos_type seekpos(pos_type pos, std::ios::openmode mode) override {
+    return dest_->pubseekpos(pos, mode);
+  }
+  int sync() override {
+    return dest_->pubsync();
+  }
+};
+
+class CrcIStreambuf : public std::streambuf {
+  std::streambuf* src_;
+  uint crc_ = 0;
+ public:
+  CrcIStreambuf(std::streambuf* src) : src_(src) {}
+  uint crc() const { return crc_; }
+  void reset() { crc_ = 0; }
+ protected:
+  std::streamsize xsgetn(char* s, std::streamsize n) override {
+    std::streamsize out = src_->sgetn(s, n);
+    crc_ = crc32c(s, out, crc_);
+    return out;
+  }
+  int_type underflow() override {
+    return src_->sgetc();
+  }
+  int_type uflow() override {
+    int_type ch = src_->sbumpc();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      char c = traits_type::to_char_type(ch);
+      crc_ = crc32c(&c, 1, crc_);
+    }
+    return ch;
+  }
+  pos_type seekoff(off_type off, std::ios::seekdir dir, std::ios::openmode mode) override {
+    return src_->pubseekoff(off, dir, mode);
+  }
+  pos_type seekpos(pos_type pos, std::ios::openmode mode) override {
+    return src_->pubseekpos(pos, mode);
+  }
+};
+
+// Read-only stream buffer over a memory block.
+class MemStreambuf : public std::streambuf {
+ public:
+  MemStreambuf(const char* data, size_t n) {
+    char* p = const_cast<char*>(data);
+    setg(p, p, p + n);
+  }
+ protected:
+  pos_type seekoff(off_type off, std::ios::seekdir dir, std::ios::openmode mode) override {
+    char* base = dir == std::ios::beg ? eback() : (dir == std::ios::cur ? gptr() : egptr());
+    if (off < eback() - base || off > egptr() - base)
+      return pos_type(off_type(-1));
+    setg(eback(), base + off, egptr());
+    return pos_type(gptr() - eback());
+  }
+  pos_type seekpos(pos_type pos, std::ios::openmode mode) override {
+    return seekoff(off_type(pos), std::ios::beg, mode);
+  }
+};
+
+// Buffered stream buffer which forwards to another buffer and adds the time
+// spent forwarding to `io_time`, such that time of serialization into the
+// buffer can be told apart from time of writing. Writes larger than the
+// buffer go straight through.
+class TimedOStreambuf : public std::streambuf {
+  std::streambuf* dest_;
+  double& io_time_;
+  vector<char> buf_;
+  ulong nbytes_ = 0;
+ public:
+  TimedOStreambuf(std::streambuf* dest, double& io_time, size_t size = 1 << 20) :
+    dest_(dest), io_time_(io_time), buf_(size) {
+    setp(buf_.data(), buf_.data() + buf_.size());
+  }
+  ~TimedOStreambuf() { flush(); }
+  // bytes put so far
+  ulong nbytes() const { return nbytes_; }
+ protected:
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    if (n > epptr() - pptr() && flush() < 0)
+      return 0;
+    nbytes_ += n;
+    if (n <= epptr() - pptr()) {
+      memcpy(pptr(), s, n);
+      pbump(static_cast<int>(n));
+      return n;
+    }
+    StatsTimer timer(io_time_);
+    return dest_->sputn(s, n);
+  }
+  int_type overflow(int_type ch) override {
+    if (flush() < 0)
+      return traits_type::eof();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(ch);
+      pbump(1);
+      nbytes_++;
+    }
+    return traits_type::not_eof(ch);
+  }
+  int sync() override {
+    return flush();
+  }
+ private:
+  int flush() {
+    std::streamsize n = pptr() - pbase();
+    if (n == 0)
+      return 0;
+    StatsTimer timer(io_time_);
+    std::streamsize out = dest_->sputn(pbase(), n);
+    setp(buf_.data(), buf_.data() + buf_.size());
+    return out == n ? 0 : -1;
+  }
+};
+
+class ChecksumException : public JamException {
+ public:
+  ChecksumException(std::string msg) : JamException(msg) {}
+};
+
+
 /* ------------------------------------------------------ */
 /* VARIADIC ELEMENT TYPE                                  */
 /* ------------------------------------------------------ */
@@ -181,7 +471,7 @@ struct VarEl {
     ushort ushort_val;
     int int_val;
     uint uint_val;
-    long long_val;
+    int64_t long_val;
     ulong ulong_val;
     float float_val;
     double double_val;
@@ -200,7 +490,7 @@ struct VarEl {
   VarEl(const ushort& val) : type(USHORT), ushort_val(val) { }
   VarEl(const int& val)    : type(INT), int_val(val) { }
   VarEl(const uint& val)   : type(UINT), uint_val(val) { }
-  VarEl(const long& val)   : type(LONG), long_val(val) { }
+  VarEl(const int64_t& val): type(LONG), long_val(val) { }
   VarEl(const ulong& val)  : type(ULONG), ulong_val(val) { }
   VarEl(const float& val)  : type(FLOAT), float_val(val) { }
   VarEl(const double& val) : type(DOUBLE), double_val(val) { }
@@ -240,7 +530,7 @@ struct VarEl {
   explicit operator ushort() const { return coerce_numeric<ushort>(); }
   explicit operator int()    const { return coerce_numeric<int>(); }
   explicit operator uint()   const { return coerce_numeric<uint>(); }
-  explicit operator long()   const { return coerce_numeric<long>(); }
+  explicit operator int64_t() const { return coerce_numeric<int64_t>(); }
   explicit operator ulong()  const { return coerce_numeric<ulong>(); }
   explicit operator float()  const { return coerce_numeric<float>(); }
   explicit operator double() const { return coerce_numeric<double>(); }
@@ -250,7 +540,7 @@ struct VarEl {
      case FLOAT:  return std::to_string(float_val);
      case DOUBLE: return std::to_string(double_val);
      case ULONG:  return std::to_string(long_val);
-     default: return std::to_string(coerce_numeric<long>());
+     default: return std::to_string(coerce_numeric<int64_t>());
     };
   }
   
@@ -282,17 +572,17 @@ struct VarEl {
   void copy(const VarEl& rhs) {
     type = rhs.type;
     switch (type) {
-     case DOUBLE: double_val = rhs.double_val;
-     case INT:    int_val    = rhs.int_val;
-     case BYTE:   byte_val   = rhs.byte_val;
-     case BOOL:   byte_val   = rhs.bool_val;
-     case UBYTE:  ubyte_val  = rhs.ubyte_val;
-     case SHORT:  short_val  = rhs.short_val;
-     case USHORT: ushort_val = rhs.ushort_val;
-     case UINT:   uint_val   = rhs.uint_val;
-     case LONG:   long_val   = rhs.long_val;
-     case ULONG:  ulong_val  = rhs.ulong_val;
-     case FLOAT:  float_val  = rhs.float_val;
+     case DOUBLE: double_val = rhs.double_val; break;
+     case INT:    int_val    = rhs.int_val; break;
+     case BYTE:   byte_val   = rhs.byte_val; break;
+     case BOOL:   byte_val   = rhs.bool_val; break;
+     case UBYTE:  ubyte_val  = rhs.ubyte_val; break;
+     case SHORT:  short_val  = rhs.short_val; break;
+     case USHORT: ushort_val = rhs.ushort_val; break;
+     case UINT:   uint_val   = rhs.uint_val; break;
+     case LONG:   long_val   = rhs.long_val; break;
+     case ULONG:  ulong_val  = rhs.ulong_val; break;
+     case FLOAT:  float_val  = rhs.float_val; break;
      case STRING: new (&string_val) string(rhs.string_val); break;
      case NIL:    nil_val    = NILVAL; break;
      default:
@@ -332,7 +622,7 @@ VE_GET(short, SHORT, short_val)
 VE_GET(ushort, USHORT, ushort_val)
 VE_GET(int, INT, int_val)
 VE_GET(uint, UINT, uint_val)
-VE_GET(long, LONG, long_val)
+VE_GET(int64_t, LONG, long_val)
 VE_GET(ulong, ULONG, ulong_val)
 VE_GET(float, FLOAT, float_val)
 VE_GET(double, DOUBLE, double_val)
@@ -344,10 +634,55 @@ VE_GET(string, STRING, string_val)
 /* } */
 
 
+// Non-owning span over contiguous elements: data of vectors in mapped
+// archives (see MappedArchive) or rows of LIST columns (see VarColl). Missing
+// values are stored as in R: NA_INT for integers, NaN for doubles.
+template<class T>
+class ColumnView {
+
+  const T* data_ = nullptr;
+  size_t size_ = 0;
+
+ public:
+
+  ColumnView() {}
+  ColumnView(const T* data, size_t size) : data_(data), size_(size) {}
+
+  const T* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const T* begin() const { return data_; }
+  const T* end() const { return data_ + size_; }
+  const T& operator[](size_t i) const { return data_[i]; }
+};
+
+// LIST column of element type T decoded from a jar chunk: flat values of
+// all rows and row offsets into them, as laid out on disk
+template<class T>
+struct ListColumn {
+  vector<ulong> offsets = vector<ulong>(1, 0);
+  vector<T> values;
+
+  size_t size() const { return offsets.size() - 1; }
+
+  ColumnView<T> operator[](size_t i) const {
+    return ColumnView<T>(values.data() + offsets[i], offsets[i + 1] - offsets[i]);
+  }
+
+  template<class Archive>
+  void serialize(Archive & archive) {
+    archive(offsets, values);
+  }
+};
+
+
 /* ------------------------------------------------------ */
 /* VARIADIC COLLECTION TYPE                               */
 /* ------------------------------------------------------ */
 
+// VECTORs hold their elements in the member of the union for el_type. LISTs
+// (list columns of jar archives) hold the elements of all rows flattened
+// into the same member; row i spans [offsets[i], offsets[i+1]).
 struct VarColl {
 
   Type coll_type;
@@ -365,6 +700,8 @@ struct VarColl {
     str_map str_map_val;
   };
 
+  vector<ulong> offsets; // LIST only; one more than the number of rows
+
   // DEFAULT CONSTRUCTOR
 
   VarColl() : coll_type(NIL), el_type(NIL), nil_val(NILVAL) {
@@ -443,9 +780,16 @@ struct VarColl {
 
   VarColl subset(size_t first, size_t last) const {
     switch (coll_type) {
+     case LIST:
+       {
+         VarColl out(LIST, el_type);
+         out.append_rows(*this, first, last);
+         return out;
+       }
      case VECTOR:
        switch (el_type) {
         case INT    : return int_vec(int_vec_val.begin() + first, int_vec_val.begin() + last);
+        case LONG   : return long_vec(long_vec_val.begin() + first, long_vec_val.begin() + last);
         case DOUBLE : return dbl_vec(dbl_vec_val.begin() + first, dbl_vec_val.begin() + last);
         case STRING : return str_vec(str_vec_val.begin() + first, str_vec_val.begin() + last);
         default:
@@ -457,9 +801,83 @@ struct VarColl {
     }    
   }
 
+  // Elements at positions `idx`, in that order
+  VarColl take(const vector<size_t>& idx) const {
+    if (coll_type == LIST) {
+      VarColl out(LIST, el_type);
+      for (size_t i : idx)
+        out.append_rows(*this, i, i + 1);
+      return out;
+    }
+    if (coll_type != VECTOR)
+      throw JamException("Take of variadic map is not implemented yet");
+    VarColl out(VECTOR, el_type);
+    switch (el_type) {
+     case INT:
+       out.int_vec_val.reserve(idx.size());
+       for (size_t i : idx) out.int_vec_val.push_back(int_vec_val[i]);
+       break;
+     case LONG:
+       out.long_vec_val.reserve(idx.size());
+       for (size_t i : idx) out.long_vec_val.push_back(long_vec_val[i]);
+       break;
+     case DOUBLE:
+       out.dbl_vec_val.reserve(idx.size());
+       for (size_t i : idx) out.dbl_vec_val.push_back(dbl_vec_val[i]);
+       break;
+     case STRING:
+       out.str_vec_val.reserve(idx.size());
+       for (size_t i : idx) out.str_vec_val.push_back(str_vec_val[i]);
+       break;
+     default:
+       throw JamException("Unsupported el type for take: " + Type2String(el_type));
+    }
+    return out;
+  }
+
+  // Append elements [first, last) of `src`, which must be of the same type
+  void append(const VarColl& src, size_t first, size_t last) {
+    if (coll_type == LIST && src.coll_type == LIST && el_type == src.el_type) {
+      append_rows(src, first, last);
+      return;
+    }
+    if (coll_type != VECTOR || src.coll_type != VECTOR || el_type != src.el_type)
+      throw JamException("Cannot append " + Type2String(src.el_type) + " to " + Type2String(el_type));
+    switch (el_type) {
+     case INT:    int_vec_val.insert(int_vec_val.end(), src.int_vec_val.begin() + first, src.int_vec_val.begin() + last); break;
+     case LONG:   long_vec_val.insert(long_vec_val.end(), src.long_vec_val.begin() + first, src.long_vec_val.begin() + last); break;
+     case DOUBLE: dbl_vec_val.insert(dbl_vec_val.end(), src.dbl_vec_val.begin() + first, src.dbl_vec_val.begin() + last); break;
+     case STRING: str_vec_val.insert(str_vec_val.end(), src.str_vec_val.begin() + first, src.str_vec_val.begin() + last); break;
+     default:
+       throw JamException("Unsupported el type for append: " + Type2String(el_type));
+    }
+  }
+
+  // Approximate memory footprint of the data (not counting map keys)
+  size_t nbytes() const {
+    size_t n = offsets.size() * sizeof(ulong);
+    switch (coll_type) {
+     case LIST:
+     case VECTOR:
+       switch (el_type) {
+        case INT:    return n + int_vec_val.size() * sizeof(int);
+        case LONG:   return n + long_vec_val.size() * sizeof(int64_t);
+        case DOUBLE: return n + dbl_vec_val.size() * sizeof(double);
+        case STRING: {
+          n += str_vec_val.size() * sizeof(string);
+          for (const auto& s : str_vec_val) n += s.capacity();
+          return n;
+        }
+        default: return 0;
+       }
+     default: return 0;
+    }
+  }
+
   // TEMPLATED UTILS
   template<class T> T& get();
   template<class T> void push_back(const T& val);
+  template<class T> ColumnView<T> row(size_t i);
 
   // ARCHIVE
 
@@ -478,24 +896,73 @@ struct VarColl {
     init();
   }
 
+  void serialize_check(cereal::BinaryOutputArchive& archive) {}
+
+  // Offsets of LISTs index into the values and never decrease
+  void serialize_check(cereal::BinaryInputArchive& archive) {
+    if (coll_type != LIST)
+      return;
+    if (offsets.empty() || offsets.front() != 0 || offsets.back() != values_size())
+      throw JamException("Corrupted LIST: offsets don't match values");
+    for (size_t i = 1; i < offsets.size(); i++)
+      if (offsets[i] < offsets[i - 1])
+        throw JamException("Corrupted LIST: decreasing offsets");
+  }
+
+  // Serialize rows [first, last) straight from the underlying vector. The
+  // output is identical to serializing subset(first, last), but nothing is
+  // copied except for rebased offsets of LISTs.
+  void serialize_range(cereal::BinaryOutputArchive& archive, size_t first, size_t last) const {
+    if (coll_type != VECTOR && coll_type != LIST)
+      throw JamException("Range serialization is not implemented for " + Type2String(coll_type));
+    archive(coll_type, el_type);
+    if (coll_type == LIST) {
+      vector<ulong> rebased(offsets.begin() + first, offsets.begin() + last + 1);
+      for (auto& o : rebased)
+        o -= offsets[first];
+      archive(rebased);
+      first = offsets[first];
+      last = offsets[last];
+    }
+    size_t n = last - first;
+    archive(cereal::make_size_tag(static_cast<cereal::size_type>(n)));
+    switch (el_type) {
+     case INT    : archive(cereal::binary_data(int_vec_val.data() + first, n * sizeof(int))); break;
+     case LONG   : archive(cereal::binary_data(long_vec_val.data() + first, n * sizeof(int64_t))); break;
+     case DOUBLE : archive(cereal::binary_data(dbl_vec_val.data() + first, n * sizeof(double))); break;
+     case STRING :
+       for (size_t i = first; i < last; i++)
+         archive(str_vec_val[i]);
+       break;
+     default:
+       throw JamException("Unsupported el type in writing VECTOR: " + Type2String(el_type));
+    }
+  }
+
   template<class Archive>
   void serialize(Archive & archive) {
     
     serialize_init(archive);
     
     switch (coll_type) {
+     case LIST:
+       archive(offsets);
+       // fall through to the flat values
      case VECTOR:
        switch (el_type) {
         case INT    : archive(int_vec_val); break;
+        case LONG   : archive(long_vec_val); break;
         case DOUBLE : archive(dbl_vec_val); break;
         case STRING : archive(str_vec_val); break;
         default:
-          throw JamException("Unsupported el type in writing VECTOR: " + Type2String(el_type));
+          throw JamException("Unsupported el type in writing " + Type2String(coll_type) + ": " +
+                             Type2String(el_type));
        }
        break;
      case MAP:
        switch (el_type) {
         case INT    : archive(int_map_val); break;
+        case LONG   : archive(long_map_val); break;
         case DOUBLE : archive(dbl_map_val); break;
         case STRING : archive(str_map_val); break;
         default:
@@ -506,6 +973,8 @@ struct VarColl {
      default:
        throw JamException("Invalid coll type during reading: " + Type2String(coll_type));
     }
+
+    serialize_check(archive);
   }
 
   size_t size() const {
@@ -519,18 +988,40 @@ struct VarColl {
        }
        break;
      case VECTOR:
-       switch (el_type) {
-        case STRING: return str_vec_val.size();
-        case INT:    return int_vec_val.size();
-        case LONG:   return long_vec_val.size();
-        case DOUBLE: return dbl_vec_val.size();
-       }
-       break;
+       return values_size();
+     case LIST:
+       return offsets.empty() ? 0 : offsets.size() - 1;
      case NIL: return 0;
     }    
   }
   
  private:
+
+  size_t values_size() const {
+    switch (el_type) {
+     case STRING: return str_vec_val.size();
+     case INT:    return int_vec_val.size();
+     case LONG:   return long_vec_val.size();
+     case DOUBLE: return dbl_vec_val.size();
+     default:     return 0;
+    }
+  }
+
+  // Append rows [first, last) of LIST `src` of the same element type
+  void append_rows(const VarColl& src, size_t first, size_t last) {
+    ulong from = src.offsets[first], to = src.offsets[last];
+    switch (el_type) {
+     case INT:    int_vec_val.insert(int_vec_val.end(), src.int_vec_val.begin() + from, src.int_vec_val.begin() + to); break;
+     case LONG:   long_vec_val.insert(long_vec_val.end(), src.long_vec_val.begin() + from, src.long_vec_val.begin() + to); break;
+     case DOUBLE: dbl_vec_val.insert(dbl_vec_val.end(), src.dbl_vec_val.begin() + from, src.dbl_vec_val.begin() + to); break;
+     case STRING: str_vec_val.insert(str_vec_val.end(), src.str_vec_val.begin() + from, src.str_vec_val.begin() + to); break;
+     default:
+       throw JamException("Unsupported el type in LIST: " + Type2String(el_type));
+    }
+    ulong base = offsets.back();
+    for (size_t i = first + 1; i <= last; i++)
+      offsets.push_back(base + src.offsets[i] - from);
+  }
   
   void init() {
     switch (coll_type) {
@@ -542,6 +1033,9 @@ struct VarColl {
         case DOUBLE: new (&dbl_map_val)  dbl_map(); break;
        }
        break;
+     case LIST:
+       offsets.assign(1, 0);
+       // fall through
      case VECTOR:
        switch (el_type) {
         case STRING: new (&str_vec_val)  str_vec(); break;
@@ -564,6 +1058,9 @@ struct VarColl {
         case DOUBLE: dbl_map_val.~dbl_map(); break;
        }
        break;
+     case LIST:
+       offsets.clear();
+       // fall through
      case VECTOR:
        switch (el_type) {
         case STRING: str_vec_val.~str_vec(); break;
@@ -578,6 +1075,7 @@ struct VarColl {
   void copy(const VarColl& rhs) {
     el_type = rhs.el_type;
     coll_type = rhs.coll_type;
+    offsets = rhs.offsets;
     
     switch (coll_type) {
      case MAP:
@@ -588,6 +1086,7 @@ struct VarColl {
         case DOUBLE: new (&dbl_map_val) dbl_map(rhs.dbl_map_val); break;
        }
        break;
+     case LIST:
      case VECTOR:
        switch (el_type) {
         case STRING: new (&str_vec_val) str_vec(rhs.str_vec_val); break;
@@ -604,6 +1103,7 @@ struct VarColl {
     PRINTALOC("move helper (VarColl)\n");
     el_type = rhs.el_type;
     coll_type = rhs.coll_type;
+    offsets = std::move(rhs.offsets);
     
     switch (coll_type) {
      case MAP:
@@ -614,6 +1114,7 @@ struct VarColl {
         case DOUBLE: new (&dbl_map_val)  dbl_map(std::move(rhs.dbl_map_val)); break;
        }
        break;
+     case LIST:
      case VECTOR:
        switch (el_type) {
         case STRING: new (&str_vec_val)  str_vec(std::move(rhs.str_vec_val)); break;
@@ -641,12 +1142,13 @@ static inline T vc_get(VarColl* vc) {
   throw JamException("Invalid type passed to get function");
 }
 
-#define VC_GET(T, CT, ET, V) template<>             \
-  inline T& VarColl::get() {                        \
-    if (el_type == ET && coll_type == CT)           \
-      return(V);                                    \
-    else throw_on_invalid_type(this, "get");        \
-  }                                                 \
+// Vectors of LISTs are their flat values
+#define VC_GET(T, CT, ET, V) template<>                                \
+  inline T& VarColl::get() {                                           \
+    if (el_type == ET && (coll_type == CT || (CT == VECTOR && coll_type == LIST))) \
+      return(V);                                                       \
+    else throw_on_invalid_type(this, "get");                           \
+  }                                                                    \
  
 VC_GET(int_vec,  VECTOR, INT,     int_vec_val)
 VC_GET(long_vec, VECTOR, LONG,    long_vec_val)
@@ -679,7 +1181,7 @@ static inline void vc_push_back(VarColl* vc, const T& val) {
   }                                                     \
 
 VC_PUSH_BACK(int,     INT,     int_vec_val)
-VC_PUSH_BACK(long,    LONG,    long_vec_val)
+VC_PUSH_BACK(int64_t, LONG,    long_vec_val)
 VC_PUSH_BACK(double,  DOUBLE,  dbl_vec_val)
 VC_PUSH_BACK(string,  STRING,  str_vec_val)
 
@@ -688,14 +1190,41 @@ inline void VarColl::push_back(const T& val) {
   return vc_push_back(this, val);
 }
 
+//// ROWS OF LISTS
+
+// Elements of row `i` of a LIST of element type T, viewed in place
+template<class T>
+inline ColumnView<T> VarColl::row(size_t i) {
+  if (coll_type != LIST)
+    throw_on_invalid_type(this, "row");
+  vector<T>& values = get<vector<T>>();
+  return ColumnView<T>(values.data() + offsets[i], offsets[i + 1] - offsets[i]);
+}
+
 
 /* ------------------------------------------------------ */
 /* READER HEAD                                            */
 /* ------------------------------------------------------ */
 
+// Head versions. Tails of VECTORs with an ALIGNED head pad each data buffer
+// such that its data starts at a multiple of JAM_ALIGNMENT bytes from the
+// beginning of the file:
+//
+// BUFFER = NPAD PAD... SIZE DATA
+//
+// where NPAD is a byte holding the number of zero PAD bytes.
+const ubyte JAM_VERSION_PLAIN = 0;
+const ubyte JAM_VERSION_ALIGNED = 1;
+const size_t JAM_ALIGNMENT = 64;
+
+// Number of PAD bytes of a buffer whose NPAD byte is at position `pos`
+inline ubyte align_padding(ulong pos) {
+  return (JAM_ALIGNMENT - (pos + 1 + sizeof(cereal::size_type)) % JAM_ALIGNMENT) % JAM_ALIGNMENT;
+}
+
 class Head {
 
-  ubyte version = 0;
+  ubyte version_ = JAM_VERSION_PLAIN;
   ubyte extra = 0;
 
  public:
@@ -728,6 +1257,60 @@ class Head {
     else extra &= ~(1 << 4);
   }
 
+  // record is followed by a map of optional sections
+  bool extbit () const {
+    return extra & (1 << 2);
+  }
+
+  void extbit (const bool bit) {
+    if (bit) extra |= (1 << 2);
+    else extra &= ~(1 << 2);
+  }
+
+  // LIST length is a 64-bit rather than 32-bit prefix (lists longer than
+  // MAX_UINT elements)
+  bool longbit () const {
+    return extra & (1 << 3);
+  }
+
+  void longbit (const bool bit) {
+    if (bit) extra |= (1 << 3);
+    else extra &= ~(1 << 3);
+  }
+
+  // objects of the archive are numbered for REF records (set on root heads
+  // of deduplicated jam archives)
+  bool refbit () const {
+    return extra & (1 << 5);
+  }
+
+  void refbit (const bool bit) {
+    if (bit) extra |= (1 << 5);
+    else extra &= ~(1 << 5);
+  }
+
+  // VECTOR tail (or INDEX) is followed by its CRC32C checksum
+  bool crcbit () const {
+    return extra & (1 << 1);
+  }
+
+  void crcbit (const bool bit) {
+    if (bit) extra |= (1 << 1);
+    else extra &= ~(1 << 1);
+  }
+
+  ubyte version () const {
+    return version_;
+  }
+
+  void version (const ubyte v) {
+    version_ = v;
+  }
+
+  bool aligned () const {
+    return version_ >= JAM_VERSION_ALIGNED;
+  }
+
   void print () const {
     print("");
   }
@@ -742,7 +1325,7 @@ class Head {
   template<class Archive>
   void serialize(Archive & archive)
   {
-    archive(coll_type, el_type, version, extra);
+    archive(coll_type, el_type, version_, extra);
   }
 };
 
@@ -755,6 +1338,24 @@ const Head JAM_NIL_HEAD = Head(jam::NIL, jam::UNDEFINED, false);
 /* UTILITIES                                              */
 /* ------------------------------------------------------ */
 
+// Size in bytes of fixed size element types
+inline size_t type_size(Type type) {
+  switch (type) {
+   case BYTE:
+   case UBYTE:  return 1;
+   case SHORT:
+   case USHORT: return 2;
+   case INT:
+   case UINT:
+   case FLOAT:  return 4;
+   case LONG:
+   case ULONG:
+   case DOUBLE: return 8;
+   default:
+     throw JamException("Type " + Type2String(type) + " has no fixed size");
+  }
+}
+
 inline vector<Head> heads_from_columns(vector<VarColl> cols) {
   vector<Head> out;
   for (const auto& col : cols) {
@@ -763,7 +1364,7 @@ inline vector<Head> heads_from_columns(vector<VarColl> cols) {
   return out;
 }
 
-inline vector<Type> types_from_columns(vector<VarColl> cols) {
+inline vector<Type> types_from_columns(const vector<VarColl>& cols) {
   vector<Type> out(cols.size());
   for (size_t i = 0; i < cols.size(); i++)
     out[i] = cols[i].el_type;
@@ -779,79 +1380,996 @@ inline vector<Type> types_from_heads(vector<Head> heads) {
 
 
 /* ------------------------------------------------------ */
-/* READER                                                 */
+/* ZONE MAPS                                              */
 /* ------------------------------------------------------ */
 
-typedef cereal::BinaryInputArchive BIN;
-
-class Reader {
+// Per-chunk, per-column value ranges. Readers use them to skip chunks which
+// cannot satisfy a predicate. Numeric columns use min/max, string columns
+// smin/smax (byte-wise order).
+struct ZoneMap {
+  ulong na_count = 0;
+  bool empty = true;   // no non-NA values
+  double min = 0, max = 0;
+  string smin, smax;
 
-  bool fetched_header_ = false;
-  bool fetched_base_header_ = false;
-  size_t nrows_;
-  
-  std::ifstream istream;
-  BIN bin_;
+  template<class Archive>
+  void serialize(Archive & archive) {
+    archive(na_count, empty, min, max, smin, smax);
+  }
+};
 
- public:
+template<class T>
+inline bool zone_is_na(const T& x) { return x == NA_INT; }
+template<>
+inline bool zone_is_na(const int64_t& x) { return x == NA_LONG; }
+template<>
+inline bool zone_is_na(const double& x) { return std::isnan(x); }
+
+// Bounds are stored as doubles. LONG bounds beyond 2^53 are rounded outwards
+// so that zone checks never exclude a chunk wrongly.
+template<class T>
+inline double zone_bound(const T& x, bool lower) { return x; }
+template<>
+inline double zone_bound(const int64_t& x, bool lower) {
+  double d = static_cast<double>(x);
+  if (lower && (d >= 9223372036854775808.0 || static_cast<int64_t>(d) > x))
+    return std::nextafter(d, -INFINITY);
+  if (!lower && d < 9223372036854775808.0 && static_cast<int64_t>(d) < x)
+    return std::nextafter(d, INFINITY);
+  return d;
+}
 
-  const string path;
-  Head head; 
-  strmap<VarColl> meta;
-  vector<strmap<VarColl>> col_metas;
-  vector<VarColl> columns;
+template<class T>
+ZoneMap numeric_zone(const T* x, size_t n) {
+  ZoneMap z;
+  T min = 0, max = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (zone_is_na(x[i])) {
+      z.na_count++;
+    } else if (z.empty) {
+      min = max = x[i];
+      z.empty = false;
+    } else {
+      if (x[i] < min) min = x[i];
+      if (x[i] > max) max = x[i];
+    }
+  }
+  z.min = zone_bound(min, true);
+  z.max = zone_bound(max, false);
+  return z;
+}
 
-  Reader(const string& path) : path(path), istream(std::ifstream(path, std::ios::binary)), bin_(istream) {
-    // waf? this doesn't work.
-    istream.exceptions(std::ifstream::failbit|std::ifstream::badbit|std::ifstream::eofbit);
+// Strings are supplied as (pointer, length) pairs by `get(i)`.
+template<class Getter>
+ZoneMap string_zone(size_t n, Getter get) {
+  ZoneMap z;
+  const char *pmin = nullptr, *pmax = nullptr;
+  size_t lmin = 0, lmax = 0;
+  auto less = [](const char* a, size_t la, const char* b, size_t lb) {
+    int cmp = std::memcmp(a, b, std::min(la, lb));
+    return cmp < 0 || (cmp == 0 && la < lb);
   };
-  /* Reader(std::istream& istream) : path(""), bin_(istream) {}; */
+  for (size_t i = 0; i < n; i++) {
+    std::pair<const char*, size_t> s = get(i);
+    if (!pmin || less(s.first, s.second, pmin, lmin)) { pmin = s.first; lmin = s.second; }
+    if (!pmax || less(pmax, lmax, s.first, s.second)) { pmax = s.first; lmax = s.second; }
+  }
+  if (pmin) {
+    z.empty = false;
+    z.smin.assign(pmin, lmin);
+    z.smax.assign(pmax, lmax);
+  }
+  return z;
+}
 
-  str_vec names() {
-    if (!fetched_base_header_)
-      throw JamException("Header hasn't been fetched yet");
-    return meta["names"].get<str_vec>();
+// A comparison of a column against a constant, or a set membership test
+// (IN). Predicates are conjunctions of conditions.
+struct Condition {
+  enum Op : ubyte { LT, LE, GT, GE, EQ, IN };
+  size_t col = 0;
+  Op op = EQ;
+  bool is_string = false;
+  double value = 0;   // LT ... EQ
+  string svalue;
+  dbl_vec values;     // IN
+  str_vec svalues;
+};
+
+// False if no row of the chunk can satisfy the condition.
+inline bool zone_may_match(const ZoneMap& z, const Condition& cond) {
+  if (z.empty)
+    return false; // comparisons with NA are never true
+  if (cond.is_string) {
+    const string& v = cond.svalue;
+    switch (cond.op) {
+     case Condition::LT: return z.smin < v;
+     case Condition::LE: return z.smin <= v;
+     case Condition::GT: return z.smax > v;
+     case Condition::GE: return z.smax >= v;
+     case Condition::EQ: return z.smin <= v && v <= z.smax;
+     case Condition::IN:
+       for (const auto& x : cond.svalues)
+         if (z.smin <= x && x <= z.smax) return true;
+       return false;
+    }
+  } else {
+    double v = cond.value;
+    switch (cond.op) {
+     case Condition::LT: return z.min < v;
+     case Condition::LE: return z.min <= v;
+     case Condition::GT: return z.max > v;
+     case Condition::GE: return z.max >= v;
+     case Condition::EQ: return z.min <= v && v <= z.max;
+     case Condition::IN:
+       for (double x : cond.values)
+         if (z.min <= x && x <= z.max) return true;
+       return false;
+    }
   }
-  
-  size_t ncols() const {
-    return col_metas.size();
+  return true;
+}
+
+
+/* ------------------------------------------------------ */
+/* BLOOM FILTERS                                          */
+/* ------------------------------------------------------ */
+
+// Per-chunk set membership filters for equality lookups on INT and STRING
+// columns. Elements are added and probed through 64-bit hashes; probe
+// positions are derived by double hashing.
+
+inline ulong bloom_mix(ulong h) {
+  // splitmix64 finalizer
+  h ^= h >> 30; h *= 0xbf58476d1ce4e5b9UL;
+  h ^= h >> 27; h *= 0x94d049bb133111ebUL;
+  h ^= h >> 31;
+  return h;
+}
+
+inline ulong bloom_hash(int x) {
+  return bloom_mix(static_cast<ulong>(static_cast<uint>(x)) + 0x9e3779b97f4a7c15UL);
+}
+
+inline ulong bloom_hash(const char* s, size_t n) {
+  ulong h = 0xcbf29ce484222325UL; // FNV-1a
+  for (size_t i = 0; i < n; i++) {
+    h ^= static_cast<ubyte>(s[i]);
+    h *= 0x100000001b3UL;
   }
+  return bloom_mix(h);
+}
 
-  size_t nrows() const {
-    return nrows_;
+inline ulong bloom_hash(const string& s) {
+  return bloom_hash(s.data(), s.size());
+}
+
+struct BloomFilter {
+  uint k = 0;           // number of probes; 0 for a missing filter
+  vector<ulong> bits;
+
+  // Size for the number of distinct `hashes` and false positive rate `fpp`.
+  BloomFilter() {}
+  BloomFilter(vector<ulong> hashes, double fpp = 0.01) {
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    size_t n = std::max<size_t>(hashes.size(), 1);
+    double m = -(double) n * std::log(fpp) / (std::log(2.0) * std::log(2.0));
+    size_t nwords = std::max<size_t>(1, (size_t) std::ceil(m / 64));
+    bits.assign(nwords, 0);
+    k = std::max<uint>(1, (uint) std::round(nwords * 64.0 / n * std::log(2.0)));
+    k = std::min<uint>(k, 16);
+    for (ulong h : hashes)
+      add(h);
   }
 
-  vector<Type> coll_types() {
-    vector<Type> out;
-    for (const auto& c : columns) {
-      out.push_back(c.coll_type);
+  bool empty() const {
+    return k == 0;
+  }
+
+  void add(ulong h) {
+    ulong m = bits.size() * 64;
+    ulong h1 = h & 0xffffffff, h2 = (h >> 32) | 1;
+    for (uint i = 0; i < k; i++) {
+      ulong pos = (h1 + i * h2) % m;
+      bits[pos >> 6] |= 1UL << (pos & 63);
     }
-    return out;
   }
 
-  vector<Type> el_types() {
-    vector<Type> out;
-    for (const auto& c : columns) {
-      out.push_back(c.el_type);
+  // Missing filters may contain anything.
+  bool may_contain(ulong h) const {
+    if (empty()) return true;
+    ulong m = bits.size() * 64;
+    ulong h1 = h & 0xffffffff, h2 = (h >> 32) | 1;
+    for (uint i = 0; i < k; i++) {
+      ulong pos = (h1 + i * h2) % m;
+      if (!(bits[pos >> 6] & (1UL << (pos & 63))))
+        return false;
     }
-    return out;
+    return true;
   }
-  
-  Reader& fetch_header () {
-    bin_(head);
-    if (head.coll_type != DF)
-      throw JamException("Can read only objects of type DF. Found " + Type2String(head.coll_type));
-    if (head.contbit()) {
-      if (!fetched_base_header_)
-        throw JamException("Continuation header encountered, but no base header has been fetched yet");
-    } else {
-      bin_(meta, col_metas);
-      fetched_base_header_ = true;
+
+  template<class Archive>
+  void serialize(Archive & archive) {
+    archive(k, bits);
+  }
+};
+
+// Integer values only can be stored in INT columns.
+inline bool bloom_may_contain(const BloomFilter& bloom, double x) {
+  if (!(x >= MIN_INT && x <= MAX_INT) || x != std::floor(x))
+    return false;
+  return bloom.may_contain(bloom_hash(static_cast<int>(x)));
+}
+
+// False if the filter rules out all values of an EQ or IN condition.
+inline bool bloom_may_match(const BloomFilter& bloom, const Condition& cond) {
+  if (bloom.empty())
+    return true;
+  switch (cond.op) {
+   case Condition::EQ:
+     if (cond.is_string)
+       return bloom.may_contain(bloom_hash(cond.svalue));
+     return bloom_may_contain(bloom, cond.value);
+   case Condition::IN:
+     if (cond.is_string) {
+       for (const auto& x : cond.svalues)
+         if (bloom.may_contain(bloom_hash(x))) return true;
+     } else {
+       for (double x : cond.values)
+         if (bloom_may_contain(bloom, x)) return true;
+     }
+     return false;
+   default:
+     return true;
+  }
+}
+
+
+/* ------------------------------------------------------ */
+/* COLUMN INTERFACE                                       */
+/* ------------------------------------------------------ */
+
+// Writer accepts columns of any type providing these six functions.
+
+inline size_t column_size(const VarColl& col) {
+  return col.size();
+}
+
+inline Type column_type(const VarColl& col) {
+  return col.el_type;
+}
+
+// VECTOR or LIST (flat values with row offsets)
+inline Type column_coll_type(const VarColl& col) {
+  return col.coll_type;
+}
+
+inline void serialize_column(cereal::BinaryOutputArchive& archive, const VarColl& col, size_t first, size_t last) {
+  if (first == 0 && last == col.size())
+    archive(col);
+  else
+    col.serialize_range(archive, first, last);
+}
+
+// Append hashes of non-NA elements for Bloom filters
+inline void column_hashes(const VarColl& col, size_t first, size_t last, vector<ulong>& out) {
+  if (col.coll_type != VECTOR)
+    throw JamException("Bloom filters are not supported for " + Type2String(col.coll_type) + " columns");
+  switch (col.el_type) {
+   case INT:
+     for (size_t i = first; i < last; i++)
+       if (col.int_vec_val[i] != NA_INT)
+         out.push_back(bloom_hash(col.int_vec_val[i]));
+     break;
+   case STRING:
+     for (size_t i = first; i < last; i++)
+       out.push_back(bloom_hash(col.str_vec_val[i]));
+     break;
+   default:
+     throw JamException("Bloom filters are supported for INT and STRING columns only");
+  }
+}
+
+inline ZoneMap column_zone(const VarColl& col, size_t first, size_t last) {
+  if (col.coll_type != VECTOR)
+    return ZoneMap();
+  switch (col.el_type) {
+   case INT:    return numeric_zone(col.int_vec_val.data() + first, last - first);
+   case LONG:   return numeric_zone(col.long_vec_val.data() + first, last - first);
+   case DOUBLE: return numeric_zone(col.dbl_vec_val.data() + first, last - first);
+   case STRING:
+     return string_zone(last - first, [&](size_t i) {
+         const string& s = col.str_vec_val[first + i];
+         return std::make_pair(s.data(), s.size());
+       });
+   default:
+     return ZoneMap();
+  }
+}
+
+
+/* ------------------------------------------------------ */
+/* CHUNK INDEX                                            */
+/* ------------------------------------------------------ */
+
+// LAYOUT:
+// JAR    = BASE_CHUNK CONT_CHUNK... [FOOTER]
+// BASE_CHUNK = HEAD META COL_METAS COLS
+// CONT_CHUNK = HEAD(cont) COLS
+// FOOTER = [BLOOMS] HEAD(INDEX) INDEX [CRCS] [SECTIONS] INDEX_OFFSET MAGIC
+// BLOOMS = HEAD(BLOOM) SIZE FILTER...
+// COLS   = NCOLS COL...
+// COL    = VECTOR EL_TYPE VALUES | LIST EL_TYPE OFFSETS VALUES
+//
+// LIST columns hold atomic vectors of a common element type per row, stored
+// as the flat VALUES of all rows of the chunk and NROWS + 1 OFFSETS into
+// them (see VarColl). Index col_types are element types; the "coll_types"
+// section marks LIST columns.
+//
+// The index is written at the end of the file and located through the last
+// 16 bytes. Sequential readers skip over it. When INDEX head has the crc bit
+// set, the index is followed by CRC32C checksums of the COLS payloads. With
+// the ext bit, a map of named SECTIONS holds optional per-chunk data (zone
+// maps, locations of Bloom filters). Readers ignore sections they don't
+// know. Bloom filters are stored column by column in a separate record such
+// that lookups load only the filters of the queried columns.
+
+const ulong JAR_INDEX_MAGIC = 0x315844494a52414aUL; // "JARJIDX1"
+
+// File location of a serialized BloomFilter
+struct BloomRef {
+  ulong offset = 0;
+  ulong nbytes = 0;
+
+  template<class Archive>
+  void serialize(Archive & archive) {
+    archive(offset, nbytes);
+  }
+};
+
+struct BloomSection {
+  ulong offset = 0;                 // position of the BLOOMS record
+  vector<vector<BloomRef>> refs;    // by chunk
+
+  template<class Archive>
+  void serialize(Archive & archive) {
+    archive(offset, refs);
+  }
+};
+
+struct ChunkInfo {
+  ulong offset = 0;          // file position of the COLS payload
+  ulong nbytes = 0;          // size of the COLS payload
+  ulong nrows = 0;
+  bool continuation = true;  // false if chunk has a base header
+  // not serialized with the chunk info
+  uint crc = 0;              // checksum of the COLS payload
+  vector<ZoneMap> zones;     // one per column
+  vector<BloomRef> bloom_refs;  // one per column (empty refs for columns without filters)
+  vector<BloomFilter> blooms;   // filters held by writers until the footer is written
+
+  template<class Archive>
+  void serialize(Archive & archive) {
+    archive(offset, nbytes, nrows, continuation);
+  }
+};
+
+struct Index {
+  vector<Type> col_types;
+  vector<ChunkInfo> chunks;
+  bool has_crc = false;
+  bool has_zones = false;
+  ulong bloom_offset = 0;   // position of the BLOOMS record; 0 if none
+  vector<Type> coll_types;  // by column if some column is a LIST, else empty
+
+  size_t nrows() const {
+    size_t n = 0;
+    for (const auto& ch : chunks) n += ch.nrows;
+    return n;
+  }
+
+  Type coll_type(size_t col) const {
+    return col < coll_types.size() ? coll_types[col] : VECTOR;
+  }
+
+  // Record collection types of columns, only if some column is a LIST
+  void set_coll_types(const vector<Type>& types) {
+    coll_types.clear();
+    if (std::find(types.begin(), types.end(), LIST) != types.end())
+      coll_types = types;
+  }
+
+  template<class Archive>
+  void serialize(Archive & archive) {
+    archive(col_types, chunks);
+  }
+
+  vector<uint> crcs() const {
+    vector<uint> out(chunks.size());
+    for (size_t i = 0; i < chunks.size(); i++)
+      out[i] = chunks[i].crc;
+    return out;
+  }
+
+  void crcs(const vector<uint>& crcs) {
+    if (crcs.size() != chunks.size())
+      throw JamException("Corrupted jar index: number of checksums doesn't match number of chunks");
+    for (size_t i = 0; i < chunks.size(); i++)
+      chunks[i].crc = crcs[i];
+    has_crc = true;
+  }
+
+  strmap<string> sections() const {
+    strmap<string> out;
+    if (has_zones) {
+      vector<vector<ZoneMap>> zones(chunks.size());
+      for (size_t i = 0; i < chunks.size(); i++)
+        zones[i] = chunks[i].zones;
+      out["zones"] = pack(zones);
+    }
+    if (bloom_offset > 0) {
+      BloomSection bloom;
+      bloom.offset = bloom_offset;
+      bloom.refs.resize(chunks.size());
+      for (size_t i = 0; i < chunks.size(); i++)
+        bloom.refs[i] = chunks[i].bloom_refs;
+      out["bloom"] = pack(bloom);
+    }
+    if (!coll_types.empty())
+      out["coll_types"] = pack(coll_types);
+    return out;
+  }
+
+  void sections(const strmap<string>& sections) {
+    auto zones = sections.find("zones");
+    if (zones != sections.end()) {
+      vector<vector<ZoneMap>> z;
+      unpack(zones->second, z);
+      if (z.size() != chunks.size())
+        throw JamException("Corrupted jar index: number of zone maps doesn't match number of chunks");
+      for (size_t i = 0; i < chunks.size(); i++)
+        chunks[i].zones = std::move(z[i]);
+      has_zones = true;
+    }
+    auto bloom = sections.find("bloom");
+    if (bloom != sections.end()) {
+      BloomSection b;
+      unpack(bloom->second, b);
+      if (b.refs.size() != chunks.size())
+        throw JamException("Corrupted jar index: number of bloom filters doesn't match number of chunks");
+      for (size_t i = 0; i < chunks.size(); i++)
+        chunks[i].bloom_refs = std::move(b.refs[i]);
+      bloom_offset = b.offset;
+    }
+    auto colls = sections.find("coll_types");
+    if (colls != sections.end())
+      unpack(colls->second, coll_types);
+  }
+
+  template<class T>
+  static string pack(const T& x) {
+    std::ostringstream out;
+    {
+      cereal::BinaryOutputArchive bout(out);
+      bout(x);
+    }
+    return out.str();
+  }
+
+  template<class T>
+  static void unpack(const string& data, T& x) {
+    MemStreambuf mem(data.data(), data.size());
+    std::istream in(&mem);
+    cereal::BinaryInputArchive bin(in);
+    bin(x);
+  }
+};
+
+// False if no row of the chunk can satisfy all conditions.
+inline bool chunk_may_match(const ChunkInfo& chunk, const vector<Condition>& conditions) {
+  for (const auto& cond : conditions) {
+    if (cond.col < chunk.zones.size() && !zone_may_match(chunk.zones[cond.col], cond))
+      return false;
+  }
+  return true;
+}
+
+const Head JAM_INDEX_HEAD = Head(jam::INDEX, jam::MIXED, false);
+
+// Read INDEX [CRCS] [SECTIONS] following an INDEX head.
+template<class Archive>
+void read_index(Archive& bin, const Head& head, Index& index) {
+  bin(index);
+  if (head.crcbit()) {
+    vector<uint> crcs;
+    bin(crcs);
+    index.crcs(crcs);
+  }
+  if (head.extbit()) {
+    strmap<string> sections;
+    bin(sections);
+    index.sections(sections);
+  }
+}
+
+inline std::streamoff stream_pos(std::streambuf* sb, std::ios::openmode mode = std::ios::in) {
+  return sb->pubseekoff(0, std::ios::cur, mode);
+}
+
+// Read raw COLS payload from current position and check it against the
+// chunk checksum before decoding, such that corrupted bytes never reach the
+// decoder. Throws ChecksumException on mismatch.
+inline void read_verified_payload(std::istream& istream, const ChunkInfo& info, vector<VarColl>& out) {
+  string buf(info.nbytes, '\0');
+  if ((ulong) istream.rdbuf()->sgetn(&buf[0], info.nbytes) != info.nbytes)
+    throw ChecksumException("Truncated chunk at offset " + std::to_string(info.offset));
+  if (crc32c(buf.data(), buf.size()) != info.crc)
+    throw ChecksumException("Checksum mismatch in chunk at offset " + std::to_string(info.offset));
+  MemStreambuf mem(buf.data(), buf.size());
+  std::istream min(&mem);
+  cereal::BinaryInputArchive bin(min);
+  bin(out);
+}
+
+inline BloomFilter read_bloom(std::istream& istream, const BloomRef& ref) {
+  BloomFilter out;
+  if (ref.nbytes == 0)
+    return out;
+  string buf(ref.nbytes, '\0');
+  std::streambuf* sb = istream.rdbuf();
+  if (sb->pubseekpos(ref.offset, std::ios::in) != std::streampos(ref.offset) ||
+      (ulong) sb->sgetn(&buf[0], ref.nbytes) != ref.nbytes)
+    throw JamException("Cannot read bloom filter at offset " + std::to_string(ref.offset));
+  Index::unpack(buf, out);
+  return out;
+}
+
+// Skip BLOOMS record following its head
+template<class Archive>
+void skip_blooms(Archive& bin, std::istream& istream) {
+  cereal::size_type size;
+  bin(cereal::make_size_tag(size));
+  istream.rdbuf()->pubseekoff(size, std::ios::cur, std::ios::in);
+}
+
+// Read COLS payload of a chunk from an arbitrary stream. Used by Reader and
+// by threads which decode chunks on their own file handles.
+inline void read_chunk_payload(std::istream& istream, const ChunkInfo& info, vector<VarColl>& out,
+                               bool verify = false) {
+  if (istream.rdbuf()->pubseekpos(info.offset, std::ios::in) != std::streampos(info.offset))
+    throw JamException("Cannot seek to chunk at offset " + std::to_string(info.offset));
+  if (verify) {
+    read_verified_payload(istream, info, out);
+  } else {
+    cereal::BinaryInputArchive bin(istream);
+    bin(out);
+  }
+}
+
+
+// Rows of a column buffer which are closer than this many bytes are fetched
+// with one contiguous read rather than with a seek each
+const size_t ROWS_SPAN_BYTES = 1 << 16;
+
+// Skips of at most this many bytes are read through rather than seeked over;
+// seeking a filebuf discards its read buffer
+const size_t SKIP_READ_BYTES = 1 << 12;
+
+// Advance `sb` by `n` bytes, reading short skips into `scratch`
+inline void skip_bytes(std::streambuf* sb, ulong n, vector<char>& scratch) {
+  if (n > SKIP_READ_BYTES) {
+    sb->pubseekoff(n, std::ios::cur, std::ios::in);
+    return;
+  }
+  if (scratch.size() < n)
+    scratch.resize(SKIP_READ_BYTES);
+  if (sb->sgetn(scratch.data(), n) != (std::streamsize) n)
+    throw JamException("Truncated string column at offset " + std::to_string(stream_pos(sb)));
+}
+
+// Append elements at sorted positions `rows` of the buffer of `n` elements
+// of type T starting at `start`. Leave the stream at the end of the buffer.
+template<class T>
+inline void read_buffer_rows(std::streambuf* sb, ulong start, ulong n,
+                             const vector<ulong>& rows, vector<T>& out) {
+  const ulong span = std::max<ulong>(1, ROWS_SPAN_BYTES / sizeof(T));
+  out.reserve(out.size() + rows.size());
+  vector<T> buf;
+  size_t j = 0;
+  while (j < rows.size()) {
+    ulong from = rows[j];
+    size_t last = j;
+    while (last + 1 < rows.size() && rows[last + 1] < from + span)
+      last++;
+    if (rows[last] >= n)
+      throw JamException("Row " + std::to_string(rows[last]) + " is out of range of chunk (" +
+                         std::to_string(n) + " rows)");
+    buf.resize(rows[last] - from + 1);
+    std::streamsize nbytes = buf.size() * sizeof(T);
+    ulong pos = start + from * sizeof(T);
+    if (sb->pubseekpos(pos, std::ios::in) != std::streampos(pos) ||
+        sb->sgetn(reinterpret_cast<char*>(buf.data()), nbytes) != nbytes)
+      throw JamException("Truncated column buffer at offset " + std::to_string(pos));
+    for (; j <= last; j++)
+      out.push_back(buf[rows[j] - from]);
+  }
+  sb->pubseekpos(start + n * sizeof(T), std::ios::in);
+}
+
+// Read rows at sorted positions `rows` (relative to the chunk, repetitions
+// allowed) of the COLS payload of a chunk. Only the selected elements of
+// fixed width columns are read; string columns are scanned and LIST columns
+// are read whole.
+inline void read_chunk_rows(std::istream& istream, const ChunkInfo& info,
+                            const vector<ulong>& rows, vector<VarColl>& out) {
+  std::streambuf* sb = istream.rdbuf();
+  if (sb->pubseekpos(info.offset, std::ios::in) != std::streampos(info.offset))
+    throw JamException("Cannot seek to chunk at offset " + std::to_string(info.offset));
+  cereal::BinaryInputArchive bin(istream);
+  cereal::size_type ncols;
+  bin(cereal::make_size_tag(ncols));
+  out.assign(ncols, VarColl());
+  for (size_t c = 0; c < ncols; c++) {
+    Type coll_type, el_type;
+    bin(coll_type, el_type);
+    if (coll_type == LIST) {
+      // re-read the column with its head
+      sb->pubseekoff(-(std::streamoff) (sizeof(coll_type) + sizeof(el_type)), std::ios::cur, std::ios::in);
+      VarColl whole;
+      bin(whole);
+      if (!rows.empty() && rows.back() >= whole.size())
+        throw JamException("Row " + std::to_string(rows.back()) + " is out of range of chunk (" +
+                           std::to_string(whole.size()) + " rows)");
+      out[c] = whole.take(vector<size_t>(rows.begin(), rows.end()));
+      continue;
+    }
+    if (coll_type != VECTOR)
+      throw JamException("Reading of rows is not implemented for " + Type2String(coll_type) + " columns");
+    VarColl& col = out[c] = VarColl(VECTOR, el_type);
+    cereal::size_type n;
+    bin(cereal::make_size_tag(n));
+    ulong start = stream_pos(sb);
+    switch (el_type) {
+     case INT:    read_buffer_rows(sb, start, n, rows, col.int_vec_val); break;
+     case LONG:   read_buffer_rows(sb, start, n, rows, col.long_vec_val); break;
+     case DOUBLE: read_buffer_rows(sb, start, n, rows, col.dbl_vec_val); break;
+     case STRING:
+       {
+         col.str_vec_val.reserve(rows.size());
+         vector<char> scratch;
+         size_t j = 0;
+         for (ulong i = 0; i < n; i++) {
+           // nothing after the last column needs to be scanned
+           if (j == rows.size() && c + 1 == ncols)
+             break;
+           cereal::size_type len;
+           bin(cereal::make_size_tag(len));
+           if (j == rows.size() || rows[j] != i) {
+             skip_bytes(sb, len, scratch);
+             continue;
+           }
+           string str(len, '\0');
+           if (len > 0 && sb->sgetn(&str[0], len) != (std::streamsize) len)
+             throw JamException("Truncated string column at offset " + std::to_string(stream_pos(sb)));
+           for (; j < rows.size() && rows[j] == i; j++)
+             col.str_vec_val.push_back(str);
+         }
+         if (j < rows.size())
+           throw JamException("Row " + std::to_string(rows[j]) + " is out of range of chunk (" +
+                              std::to_string(n) + " rows)");
+       }
+       break;
+     default:
+       throw JamException("Unsupported el type in reading VECTOR: " + Type2String(el_type));
     }
+  }
+}
+
+/* ------------------------------------------------------ */
+/* PREFETCHING                                            */
+/* ------------------------------------------------------ */
+
+// Lock-free single-producer/single-consumer ring buffer. One slot is kept
+// empty to distinguish full from empty state.
+template<class T>
+class SpscQueue {
+
+  vector<T> buf_;
+  std::atomic<size_t> head_; // next slot to pop (owned by consumer)
+  std::atomic<size_t> tail_; // next slot to push (owned by producer)
+
+ public:
+
+  SpscQueue(size_t capacity) : buf_(capacity + 1), head_(0), tail_(0) {}
+
+  bool push(T&& el) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t next = (tail + 1) % buf_.size();
+    if (next == head_.load(std::memory_order_acquire))
+      return false;
+    buf_[tail] = std::move(el);
+    tail_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T& el) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire))
+      return false;
+    el = std::move(buf_[head]);
+    head_.store((head + 1) % buf_.size(), std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+};
+
+// Back off progressively while waiting on the other end of a queue.
+inline void backoff(size_t& spins) {
+  if (spins++ < 64)
+    std::this_thread::yield();
+  else
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+// A decoded chunk together with the header which preceded it. Meta is filled
+// only for base (non-continuation) headers.
+struct Chunk {
+  Head head;
+  strmap<VarColl> meta;
+  vector<strmap<VarColl>> col_metas;
+  vector<VarColl> columns;
+  size_t nbytes = 0;
+  size_t number = 0;         // position of the chunk in the file
+  bool eof = false;
+  bool corrupted = false;    // checksum mismatch; columns are empty
+  string error;
+};
+
+
+/* ------------------------------------------------------ */
+/* READER                                                 */
+/* ------------------------------------------------------ */
+
+// Summary of a jar archive. Built from the base header and the chunk index
+// only; no column data is decoded.
+struct Description {
+  strmap<VarColl> meta;
+  vector<strmap<VarColl>> col_metas;
+  str_vec names;
+  vector<Type> col_types;
+  Index index;
+  ulong file_size = 0;
+  bool indexed = false; // index read from the footer rather than by a scan
+};
+
+typedef cereal::BinaryInputArchive BIN;
+
+class Reader {
+
+  bool fetched_header_ = false;
+  bool fetched_base_header_ = false;
+  size_t nrows_ = 0;
+  
+  std::ifstream istream;
+  BIN bin_;
+
+ public:
+
+  const string path;
+  Head head; 
+  strmap<VarColl> meta;
+  vector<strmap<VarColl>> col_metas;
+  vector<VarColl> columns;
+  Stats stats;
+
+  Reader(const string& path) : path(path), istream(std::ifstream(path, std::ios::binary)), bin_(istream) {
+    // waf? this doesn't work.
+    istream.exceptions(std::ifstream::failbit|std::ifstream::badbit|std::ifstream::eofbit);
+  };
+  /* Reader(std::istream& istream) : path(""), bin_(istream) {}; */
+
+  ~Reader() {
+    stop_prefetch();
+  }
+
+  str_vec names() {
+    if (!fetched_base_header_)
+      throw JamException("Header hasn't been fetched yet");
+    return meta["names"].get<str_vec>();
+  }
+  
+  size_t ncols() const {
+    return col_metas.size();
+  }
+
+  size_t nrows() const {
+    return nrows_;
+  }
+
+  vector<Type> coll_types() {
+    vector<Type> out;
+    for (const auto& c : columns) {
+      out.push_back(c.coll_type);
+    }
+    return out;
+  }
+
+  vector<Type> el_types() {
+    vector<Type> out;
+    for (const auto& c : columns) {
+      out.push_back(c.el_type);
+    }
+    return out;
+  }
+  
+  Reader& fetch_header () {
+    read_header(head, meta, col_metas, fetched_base_header_);
+    if (!head.contbit())
+      fetched_base_header_ = true;
     fetched_header_ = true;
     return *this;
   }
 
+  // Fetch chunk index from the footer. Files without a footer (written by
+  // older versions or by appending writers) are indexed by a full scan.
+  const Index& fetch_index() {
+    if (!fetched_index_) {
+      footer_offset_ = read_footer(istream, index_);
+      if (footer_offset_ == 0)
+        index_ = scan_index(path);
+      fetched_index_ = true;
+    }
+    return index_;
+  }
+
+  // File position of the footer; 0 if the file has no footer.
+  ulong footer_offset() {
+    fetch_index();
+    return footer_offset_;
+  }
+
+  size_t nchunks() {
+    return fetch_index().chunks.size();
+  }
+
+  // Describe the archive without reading column data. Archives with a footer
+  // are described from the first and the last few bytes of the file.
+  Description describe() {
+    Description out;
+    if (!fetched_base_header_)
+      fetch_header();
+    out.meta = meta;
+    out.col_metas = col_metas;
+    if (meta.find("names") != meta.end())
+      out.names = names();
+    out.index = fetch_index();
+    out.col_types = out.index.col_types;
+    out.indexed = footer_offset_ > 0;
+    std::streambuf* sb = istream.rdbuf();
+    std::streamoff pos = stream_pos(sb);
+    out.file_size = sb->pubseekoff(0, std::ios::end, std::ios::in);
+    sb->pubseekpos(pos, std::ios::in);
+    return out;
+  }
+
+  // Check chunk payloads against checksums in the index while reading. With
+  // `skip_corrupted` chunks which fail verification are dropped and recorded
+  // in corrupted_chunks(), otherwise ChecksumException is thrown. Return false
+  // (and don't verify) if the archive has no checksums. Must be called before
+  // reading or prefetching.
+  bool verify(bool skip_corrupted = false) {
+    if (!fetch_index().has_crc)
+      return false;
+    verify_ = true;
+    skip_corrupted_ = skip_corrupted;
+    init_indexed();
+    return true;
+  }
+
+  // Read only chunks which might contain rows satisfying all `conditions`
+  // according to their zone maps and Bloom filters. The filter is a superset;
+  // rows must still be filtered exactly by the caller. Return false (and
+  // don't filter) if the archive has neither zone maps nor Bloom
+  // filters. Conditions must refer to VECTOR columns; LIST columns have no
+  // zone maps. Must be called before reading or prefetching.
+  bool filter(const vector<Condition>& conditions) {
+    const Index& index = fetch_index();
+    if (!index.has_zones && index.bloom_offset == 0)
+      return false;
+    init_indexed();
+    size_t nchunks = index.chunks.size();
+    selected_.assign(nchunks, 1);
+    for (size_t i = 0; i < nchunks; i++)
+      selected_[i] = chunk_may_match(index.chunks[i], conditions);
+    if (index.bloom_offset > 0) {
+      // filters of one column are contiguous on disk
+      std::ifstream in(path, std::ios::binary);
+      for (const auto& cond : conditions) {
+        if (cond.op != Condition::EQ && cond.op != Condition::IN)
+          continue;
+        for (size_t i = 0; i < nchunks; i++) {
+          const vector<BloomRef>& refs = index.chunks[i].bloom_refs;
+          if (selected_[i] && cond.col < refs.size() && refs[cond.col].nbytes > 0)
+            selected_[i] = bloom_may_match(jam::read_bloom(in, refs[cond.col]), cond);
+        }
+      }
+    }
+    return true;
+  }
+
+  // Read only chunks at positions `chunks` (in file order), within those
+  // passing the filter if any. Must be called before reading or prefetching.
+  Reader& select(const vector<size_t>& chunks) {
+    size_t nchunks = fetch_index().chunks.size();
+    init_indexed();
+    vector<char> selected(nchunks, 0);
+    for (size_t i : chunks) {
+      if (i >= nchunks)
+        throw JamException("Chunk " + std::to_string(i) + " is out of range (" + std::to_string(nchunks) + " chunks)");
+      selected[i] = chunk_selected(i);
+    }
+    selected_ = std::move(selected);
+    return *this;
+  }
+
+  BloomFilter read_bloom(size_t chunk, size_t col) {
+    const vector<BloomRef>& refs = fetch_index().chunks.at(chunk).bloom_refs;
+    if (col >= refs.size())
+      return BloomFilter();
+    std::ifstream in(path, std::ios::binary);
+    return jam::read_bloom(in, refs[col]);
+  }
+
+  // Chunks which pass the filter
+  vector<size_t> selected_chunks() {
+    fetch_index();
+    vector<size_t> out;
+    for (size_t i = 0; i < index_.chunks.size(); i++)
+      if (chunk_selected(i))
+        out.push_back(i);
+    return out;
+  }
+
+  const vector<size_t>& corrupted_chunks() const {
+    return corrupted_;
+  }
+
+  // Start a background thread which reads and decodes up to `depth` chunks
+  // ahead of the consumer, as long as decoded chunks waiting in the queue
+  // don't exceed `max_bytes`. At least one chunk is always read ahead.
+  Reader& prefetch(size_t depth = 2, size_t max_bytes = 1UL << 30) {
+    if (prefetcher_.joinable())
+      throw JamException("Prefetching has already been started");
+    if (depth == 0)
+      return *this;
+    // Base header is read synchronously such that meta is available
+    // immediately to the consumer.
+    if (!fetched_header_) {
+      try {
+        fetch_header();
+      } catch (JamException&) {
+        throw;
+      } catch (std::exception&) {
+        return *this; // empty input; nothing to prefetch
+      }
+    }
+    max_prefetch_bytes_ = max_bytes;
+    prefetch_bytes_ = 0;
+    stop_ = false;
+    prefetch_eof_ = false;
+    prefetch_error_.clear();
+    queue_.reset(new SpscQueue<Chunk>(depth));
+    prefetcher_ = std::thread(&Reader::prefetch_loop, this);
+    return *this;
+  }
+
+  bool prefetching() const {
+    return queue_ != nullptr;
+  }
+
   // return empty vector if cannot read;
   vector<VarColl>& read_columns(size_t nchunks = MAX_SIZE) {
 
@@ -859,55 +2377,70 @@ class Reader {
       nchunks = MAX_SIZE;
 
     columns = vector<VarColl>();
+    nrows_ = 0;
 
-    try {
-
-      if (!fetched_header_)
-        fetch_header();
-      fetched_header_ = false;
-    
-      PRINT("started reading (nchunks %ld)\n", nchunks);
-      bin_(columns);
-      
-    } catch (std::exception&) {
-      columns = vector<VarColl>();
-      nrows_ = 0;
+    Chunk chunk;
+    if (!next_chunk(chunk))
       return columns;
-    }
-    size_t chunks = 1; 
-    
-    // cereal throws on end of input; need a double catch here
-    bool keep_reading = true;
-    while (keep_reading && chunks < nchunks) {
-      try {
-        fetch_header();
-        if (!head.contbit()) {
-          // fixme: compatible chunks should be handled
-          throw JamException("Heterogeneous chunks cannot be bound at the moment. Try non binding option instead.");
-        }
-        vector<VarColl> next; bin_(next);
-        for (size_t c = 0; c < next.size(); c++) {
-          check_col_type(columns[c], next[c], c);
-          switch (next[c].el_type) {
-           case INT:    columns[c].int_vec_val.insert(columns[c].int_vec_val.end(), next[c].int_vec_val.begin(), next[c].int_vec_val.end()); break;
-           case DOUBLE: columns[c].dbl_vec_val.insert(columns[c].dbl_vec_val.end(), next[c].dbl_vec_val.begin(), next[c].dbl_vec_val.end()); break;
-           case STRING: columns[c].str_vec_val.insert(columns[c].str_vec_val.end(), next[c].str_vec_val.begin(), next[c].str_vec_val.end()); break;
-           default:
-             throw JamException("Should never end up here; please report");
-          }
-        }
-        chunks++;
-        // fixme: throwing on eof doesn't work for unclear reason: http://stackoverflow.com/a/11808139/453735
-        // } catch (std::ios_base::failure fail) { keep_reading = false; };
-      } catch (JamException& e) {
-        throw e;
-      } catch (std::exception& e) {
-        keep_reading = false;
-      };
+
+    PRINT("started reading (nchunks %ld)\n", nchunks);
+    columns = std::move(chunk.columns);
+    size_t chunks = 1;
+
+    while (chunks < nchunks && next_chunk(chunk)) {
+      if (!chunk.head.contbit()) {
+        // fixme: compatible chunks should be handled
+        throw JamException("Heterogeneous chunks cannot be bound at the moment. Try non binding option instead.");
+      }
+      bind_columns(chunk.columns);
+      chunks++;
     }
 
     PRINT("done reading %ld chunks\n", chunks);
-    nrows_ = columns[0].size();
+    if (columns.size() > 0)
+      nrows_ = columns[0].size();
+    return columns;
+  }
+
+  // Read rows at sorted positions `rows` (0-based across chunks,
+  // repetitions allowed) into `columns`. Only chunks holding some of the rows
+  // are visited; see read_chunk_rows.
+  vector<VarColl>& read_rows(const vector<ulong>& rows) {
+    if (!std::is_sorted(rows.begin(), rows.end()))
+      throw JamException("Rows must be sorted");
+    const Index& index = fetch_index();
+    columns = vector<VarColl>();
+    nrows_ = 0;
+
+    StatsTimer timer(stats.io_time);
+    vector<ulong> chunk_rows;
+    vector<VarColl> cols;
+    ulong first = 0;
+    size_t r = 0;
+    for (size_t i = 0; i < index.chunks.size() && r < rows.size(); i++) {
+      const ChunkInfo& info = index.chunks[i];
+      chunk_rows.clear();
+      for (; r < rows.size() && rows[r] < first + info.nrows; r++)
+        chunk_rows.push_back(rows[r] - first);
+      first += info.nrows;
+      if (chunk_rows.empty())
+        continue;
+      if (!fetched_base_header_)
+        fetch_header();
+      read_chunk_rows(istream, info, chunk_rows, cols);
+      stats.objects++;
+      for (const auto& c : cols)
+        stats.add(c.el_type, c.size(), c.nbytes());
+      if (columns.empty())
+        columns = std::move(cols);
+      else
+        bind_columns(cols);
+    }
+    if (r < rows.size())
+      throw JamException("Row " + std::to_string(rows[r]) + " is out of range (" +
+                         std::to_string(index.nrows()) + " rows)");
+    if (columns.size() > 0)
+      nrows_ = columns[0].size();
     return columns;
   }
 
@@ -931,11 +2464,13 @@ class Reader {
     return out;
   }
 
+  // Return next row; empty vector at the end of input.
   vector<VarEl> read_line() {
-    if (next_row_ >= nrows()) {
+    while (next_row_ >= nrows()) {
       read_columns(1);
       next_row_ = 0;
-      if (nrows()==0) throw JamException("0 rows fetched; aborting");
+      if (columns.size() == 0)
+        return vector<VarEl>();
     }
     
     size_t nc = ncols();
@@ -944,23 +2479,322 @@ class Reader {
     for (size_t i = 0; i < nc; i++) {
       switch(columns[i].el_type) {
        case INT:    out[i] = VarEl(columns[i].int_vec_val[next_row_]); break;
+       case LONG:   out[i] = VarEl(columns[i].long_vec_val[next_row_]); break;
        case DOUBLE: out[i] = VarEl(columns[i].dbl_vec_val[next_row_]); break;
        case STRING: out[i] = VarEl(columns[i].str_vec_val[next_row_]); break;
        default:
          throw JamException("Unsupported type (should never end up here, please report)");
       }
     }
-        
+
+    next_row_++;
+    return out;
+  }
+
+ private:
+
+  size_t next_row_ = 0;
+
+  // prefetching state
+  std::thread prefetcher_;
+  std::unique_ptr<SpscQueue<Chunk>> queue_;
+  std::atomic<bool> stop_{false};
+  bool prefetch_eof_ = false;    // consumer side; the prefetcher has finished
+  string prefetch_error_;
+  std::atomic<size_t> prefetch_bytes_{0};
+  size_t max_prefetch_bytes_ = 0;
+
+  Index index_;
+  bool fetched_index_ = false;
+  ulong footer_offset_ = 0;
+
+  // Verification and filtering read chunks through the index
+  bool indexed_ = false;
+  Head base_head_;
+  size_t next_indexed_ = 0;
+  size_t chunks_read_ = 0;
+  bool verify_ = false;
+  bool skip_corrupted_ = false;
+  vector<size_t> corrupted_;
+  vector<char> selected_;   // chunks passing the filter; empty if not filtering
+
+  void init_indexed() {
+    if (prefetcher_.joinable())
+      throw JamException("Cannot change reading mode while prefetching");
+    if (!fetched_base_header_)
+      fetch_header();
+    base_head_ = head;
+    indexed_ = true;
+  }
+
+  bool chunk_selected(size_t i) const {
+    return selected_.empty() || selected_[i];
+  }
+
+  // Return footer position or 0 if footer is missing. Stream position is
+  // preserved.
+  static ulong read_footer(std::istream& istream, Index& index) {
+    std::streambuf* sb = istream.rdbuf();
+    std::streamoff pos = stream_pos(sb);
+    std::streamoff end = sb->pubseekoff(0, std::ios::end, std::ios::in);
+    ulong found = 0;
+    if (end >= 16) {
+      ulong tail[2];
+      sb->pubseekoff(-16, std::ios::end, std::ios::in);
+      if (sb->sgetn(reinterpret_cast<char*>(tail), 16) == 16 &&
+          tail[1] == JAR_INDEX_MAGIC && tail[0] < (ulong) end) {
+        sb->pubseekpos(tail[0], std::ios::in);
+        cereal::BinaryInputArchive bin(istream);
+        Head ihead;
+        bin(ihead);
+        if (ihead.coll_type != INDEX)
+          throw JamException("Corrupted jar index");
+        read_index(bin, ihead, index);
+        found = tail[0];
+      }
+    }
+    sb->pubseekpos(pos, std::ios::in);
+    return found;
+  }
+
+  static Index scan_index(const string& path) {
+    PRINT("scanning '%s' for chunks\n", path.c_str());
+    Index index;
+    std::ifstream in(path, std::ios::binary);
+    BIN bin(in);
+    bool base_fetched = false;
+    while (true) {
+      Head h;
+      strmap<VarColl> m;
+      vector<strmap<VarColl>> cm;
+      vector<VarColl> cols;
+      ChunkInfo info;
+      try {
+        bin(h);
+        if (h.coll_type == INDEX) {
+          skip_footer(bin, h);
+          continue;
+        }
+        if (h.coll_type == BLOOM) {
+          skip_blooms(bin, in);
+          continue;
+        }
+        if (h.coll_type != DF)
+          throw JamException("Can read only objects of type DF. Found " + Type2String(h.coll_type));
+        if (!h.contbit()) {
+          bin(m, cm);
+          base_fetched = true;
+        } else if (!base_fetched) {
+          throw JamException("Continuation header encountered, but no base header has been fetched yet");
+        }
+        info.offset = stream_pos(in.rdbuf());
+        bin(cols);
+      } catch (JamException&) {
+        throw;
+      } catch (std::exception&) {
+        break;
+      }
+      info.nbytes = stream_pos(in.rdbuf()) - info.offset;
+      info.nrows = cols.size() > 0 ? cols[0].size() : 0;
+      info.continuation = h.contbit();
+      if (index.chunks.size() == 0) {
+        index.col_types = types_from_columns(cols);
+        vector<Type> colls;
+        for (const auto& c : cols)
+          colls.push_back(c.coll_type);
+        index.set_coll_types(colls);
+      }
+      index.chunks.push_back(info);
+    }
+    return index;
+  }
+
+  static void skip_footer(BIN& bin, const Head& head) {
+    Index skip;
+    ulong offset, magic;
+    read_index(bin, head, skip);
+    bin(offset, magic);
+  }
+  
+  void read_header(Head& head, strmap<VarColl>& meta, vector<strmap<VarColl>>& col_metas,
+                   bool base_fetched) {
+    bin_(head);
+    // footers of previously closed writers might be followed by more chunks
+    while (head.coll_type == INDEX || head.coll_type == BLOOM) {
+      if (head.coll_type == INDEX)
+        skip_footer(bin_, head);
+      else
+        skip_blooms(bin_, istream);
+      bin_(head);
+    }
+    if (head.coll_type != DF)
+      throw JamException("Can read only objects of type DF. Found " + Type2String(head.coll_type));
+    if (head.contbit()) {
+      if (!base_fetched)
+        throw JamException("Continuation header encountered, but no base header has been fetched yet");
+    } else {
+      bin_(meta, col_metas);
+    }
+  }
+
+  // Read next header (unless already fetched) and columns from the
+  // stream. Return false on end of input. Only the prefetching thread calls
+  // this while prefetching is active.
+  bool read_chunk(Chunk& chunk) {
+    if (indexed_)
+      return read_indexed_chunk(chunk);
+    chunk.number = chunks_read_++;
+    try {
+      if (fetched_header_) {
+        chunk.head = head;
+        fetched_header_ = false;
+      } else {
+        read_header(chunk.head, chunk.meta, chunk.col_metas, fetched_base_header_);
+        if (!chunk.head.contbit())
+          fetched_base_header_ = true;
+      }
+      bin_(chunk.columns);
+      // fixme: throwing on eof doesn't work for unclear reason: http://stackoverflow.com/a/11808139/453735
+      // } catch (std::ios_base::failure fail) { keep_reading = false; };
+    } catch (JamException&) {
+      throw;
+    } catch (std::exception&) {
+      // cereal throws on end of input
+      return false;
+    }
+    return true;
+  }
+
+  // Seek to the payload of the next selected chunk. The index determines the
+  // end of input. Headers are not read; meta comes from the base header.
+  bool read_indexed_chunk(Chunk& chunk) {
+    size_t nchunks = index_.chunks.size();
+    while (next_indexed_ < nchunks && !chunk_selected(next_indexed_))
+      next_indexed_++;
+    if (next_indexed_ == nchunks)
+      return false;
+    chunk.number = next_indexed_++;
+    const ChunkInfo& info = index_.chunks[chunk.number];
+    chunk.head = base_head_;
+    chunk.head.contbit(info.continuation);
+    try {
+      read_chunk_payload(istream, info, chunk.columns, verify_);
+    } catch (ChecksumException&) {
+      if (!skip_corrupted_)
+        throw;
+      chunk.columns.clear();
+      chunk.corrupted = true;
+    }
+    return true;
+  }
+
+  bool next_chunk(Chunk& chunk) {
+    // with prefetching this is the time spent waiting for the chunk
+    StatsTimer timer(stats.io_time);
+    do {
+      chunk = Chunk();
+      if (!queue_) {
+        if (!read_chunk(chunk))
+          return false;
+      } else {
+        // the prefetcher exits after its last chunk; later calls must not
+        // wait for more
+        if (!prefetch_error_.empty())
+          throw JamException(prefetch_error_);
+        if (prefetch_eof_)
+          return false;
+        size_t spins = 0;
+        while (!queue_->pop(chunk))
+          backoff(spins);
+        prefetch_bytes_ -= chunk.nbytes;
+        if (!chunk.error.empty()) {
+          prefetch_error_ = chunk.error;
+          throw JamException(chunk.error);
+        }
+        if (chunk.eof) {
+          prefetch_eof_ = true;
+          return false;
+        }
+      }
+      head = chunk.head;
+      if (!chunk.head.contbit() && chunk.col_metas.size() > 0) {
+        meta = std::move(chunk.meta);
+        col_metas = std::move(chunk.col_metas);
+      }
+      if (chunk.corrupted)
+        corrupted_.push_back(chunk.number);
+    } while (chunk.corrupted);
+    stats.objects++;
+    for (const auto& c : chunk.columns)
+      stats.add(c.el_type, c.size(), c.nbytes());
+    return true;
+  }
+
+  void prefetch_loop() {
+    bool done = false;
+    while (!done && !stop_) {
+      Chunk chunk;
+      try {
+        if (read_chunk(chunk)) {
+          for (const auto& c : chunk.columns)
+            chunk.nbytes += c.nbytes();
+        } else {
+          chunk.eof = true;
+          done = true;
+        }
+      } catch (std::exception& e) {
+        chunk.error = e.what();
+        done = true;
+      }
+      // Wait for queue space and memory budget. The budget is relaxed when
+      // nothing is in flight such that large chunks cannot block forever.
+      size_t spins = 0;
+      while (!stop_ &&
+             prefetch_bytes_ > 0 &&
+             prefetch_bytes_ + chunk.nbytes > max_prefetch_bytes_)
+        backoff(spins);
+      prefetch_bytes_ += chunk.nbytes;
+      while (!stop_ && !queue_->push(std::move(chunk)))
+        backoff(spins);
+    }
   }
 
- private:
+  void stop_prefetch() {
+    if (prefetcher_.joinable()) {
+      stop_ = true;
+      prefetcher_.join();
+    }
+  }
 
-  size_t next_row_ = 0;
+  void bind_columns(vector<VarColl>& next) {
+    for (size_t c = 0; c < next.size(); c++) {
+      check_col_type(columns[c], next[c], c);
+      if (next[c].coll_type == LIST) {
+        columns[c].append(next[c], 0, next[c].size());
+        continue;
+      }
+      switch (next[c].el_type) {
+       case INT:    columns[c].int_vec_val.insert(columns[c].int_vec_val.end(), next[c].int_vec_val.begin(), next[c].int_vec_val.end()); break;
+       case LONG:   columns[c].long_vec_val.insert(columns[c].long_vec_val.end(), next[c].long_vec_val.begin(), next[c].long_vec_val.end()); break;
+       case DOUBLE: columns[c].dbl_vec_val.insert(columns[c].dbl_vec_val.end(), next[c].dbl_vec_val.begin(), next[c].dbl_vec_val.end()); break;
+       case STRING:
+         columns[c].str_vec_val.insert(columns[c].str_vec_val.end(),
+                                       std::make_move_iterator(next[c].str_vec_val.begin()),
+                                       std::make_move_iterator(next[c].str_vec_val.end()));
+         break;
+       default:
+         throw JamException("Should never end up here; please report");
+      }
+    }
+  }
   
   void check_col_type(const VarColl& old_col, const VarColl& new_col, size_t c) {
     if (old_col.el_type != new_col.el_type) {
       throw JamException("Column " + std::to_string(c) + " type (" + Type2String(new_col.el_type) + ") doesn't match old type (" + Type2String(old_col.el_type) + ")");
     }
+    if (old_col.coll_type != new_col.coll_type) {
+      throw JamException("Column " + std::to_string(c) + " is a " + Type2String(new_col.coll_type) + " but was a " + Type2String(old_col.coll_type));
+    }
   }
   /* // from http://stackoverflow.com/a/24868211/453735 */
   /* template <typename T> constexpr T& as_lvalue(T&& t) { return t; }; */
@@ -978,6 +2812,8 @@ typedef cereal::BinaryOutputArchive BOUT;
 class Writer {
   
   std::ofstream ostream_;
+  CrcOStreambuf crcbuf_;   // checksums chunk payloads on the fly
+  std::ostream crcstream_;
   BOUT bout_;
 
  public:
@@ -986,6 +2822,7 @@ class Writer {
   const Head head = Head(DF, MIXED, true);
   strmap<VarColl> meta;
   vector<strmap<VarColl>> col_metas;
+  Stats stats;
 
   // CONSTRUCTORS
   Writer(const string& path, bool append = false) :
@@ -994,15 +2831,31 @@ class Writer {
   Writer(const string& path, strmap<VarColl> meta, size_t ncols) :
     Writer(path, meta, vector<strmap<VarColl>>(ncols)) {}
 
-  Writer(const Reader& reader) :
-    Writer(reader.path, reader.meta, reader.col_metas) {}
+  // New archive at `path` with the meta and column metas of `reader`
+  Writer(const string& path, const Reader& reader) :
+    Writer(path, reader.meta, reader.col_metas) {}
 
+  // When appending to a non-empty file, meta and column metas are taken from
+  // the base header of the file and new chunks are written as continuation
+  // chunks over the old footer.
   Writer(const string& path, strmap<VarColl> meta, vector<strmap<VarColl>> col_metas, bool append = false) :
     path(path),
-    ostream_(std::ofstream(path, append ? (std::ios::binary | std::ios::app) : std::ios::binary)),
-    bout_(ostream_),
+    ostream_(open_stream(path, append)),
+    crcbuf_(ostream_.rdbuf()),
+    crcstream_(&crcbuf_),
+    bout_(crcstream_),
     meta(meta),
-    col_metas(col_metas){};
+    col_metas(col_metas),
+    append_(append) {
+    if (append_)
+      init_append();
+  };
+
+  ~Writer() {
+    try {
+      close();
+    } catch (...) {}
+  }
 
   // UTILS
   
@@ -1010,6 +2863,89 @@ class Writer {
     return col_metas.size();
   }
 
+  const Index& index() const {
+    return index_;
+  }
+
+  bool appending() const {
+    return append_;
+  }
+
+  // Build Bloom filters for columns `cols` (INT or STRING) of every chunk
+  // written from now on, sized for false positive rate `fpp`. Columns
+  // filtered in an appended archive stay filtered.
+  Writer& bloom(const vector<size_t>& cols, double fpp = 0.01) {
+    bloom_cols_.resize(ncols(), 0);
+    for (size_t c : cols) {
+      if (c >= ncols())
+        throw JamException("Bloom filter column " + std::to_string(c) + " is out of range");
+      bloom_cols_[c] = 1;
+    }
+    bloom_fpp_ = fpp;
+    return *this;
+  }
+
+  // Copy all chunks of `reader` verbatim, without decoding. Only chunk
+  // headers and the index are written anew; zone maps and Bloom filters are
+  // carried over. Column names, types and factor levels must match those
+  // of the chunks written so far. If nothing has been written yet and meta
+  // is empty, meta comes from `reader`. Source checksums are verified on the
+  // fly.
+  Writer& append_chunks_from(Reader& reader) {
+    Description desc = reader.describe();
+    check_compatible(desc);
+    const Index& src = desc.index;
+    std::ifstream in(reader.path, std::ios::binary);
+    // large sequential reads and writes
+    vector<char> buf(std::min<ulong>(1 << 23, max_chunk_bytes(src)));
+    for (size_t i = 0; i < src.chunks.size(); i++) {
+      const ChunkInfo& from = src.chunks[i];
+      ChunkInfo info;
+      info.nbytes = from.nbytes;
+      info.nrows = from.nrows;
+      info.continuation = append_ || index_.chunks.size() > 0;
+      if (src.has_zones)
+        info.zones = from.zones;
+      if (src.bloom_offset > 0) {
+        info.blooms.resize(from.bloom_refs.size());
+        for (size_t c = 0; c < from.bloom_refs.size(); c++)
+          info.blooms[c] = read_bloom(in, from.bloom_refs[c]);
+      }
+      StatsTimer timer(stats.io_time);
+      write_header(info.continuation);
+      info.offset = ostream_.tellp();
+      crcbuf_.reset();
+      in.seekg(from.offset);
+      for (ulong left = from.nbytes; left > 0; ) {
+        std::streamsize n = std::min<ulong>(left, buf.size());
+        if (!in.read(buf.data(), n))
+          throw JamException("Cannot read chunk at offset " + std::to_string(from.offset) + " of '" + reader.path + "'");
+        crcstream_.write(buf.data(), n);
+        left -= n;
+      }
+      info.crc = crcbuf_.crc();
+      if (src.has_crc && info.crc != from.crc)
+        throw ChecksumException("Checksum mismatch in chunk at offset " + std::to_string(from.offset) +
+                                " of '" + reader.path + "'");
+      if (index_.chunks.size() == 0) {
+        index_.col_types = src.col_types;
+        index_.coll_types = src.coll_types;
+      }
+      index_.chunks.push_back(std::move(info));
+      stats.objects++;
+    }
+    return *this;
+  }
+
+  // Write the chunk index footer and close the stream. Called on destruction.
+  void close() {
+    if (closed_) return;
+    closed_ = true;
+    if (index_.chunks.size() > 0)
+      write_footer();
+    ostream_.close();
+  }
+
   Writer& fetch_header() {
     if (path == "")
       throw JamException("Path wasn't initialized");
@@ -1044,6 +2980,14 @@ class Writer {
   }
 
   Writer& write_columns(const vector<VarColl>& cols, size_t rows_per_chunk = MAX_SIZE, bool continuation = false) {
+    return write_columns<VarColl>(cols, rows_per_chunk, continuation);
+  }
+
+  // Col is any column type providing the column interface (see VarColl
+  // overloads above). This allows
+  // writing directly from foreign containers without conversion to VarColl.
+  template<class Col>
+  Writer& write_columns(const vector<Col>& cols, size_t rows_per_chunk = MAX_SIZE, bool continuation = false) {
 
     if (meta.find("names") == meta.end()) {
       throw std::invalid_argument("Meta must contain a vector of column names named 'names'");
@@ -1052,29 +2996,33 @@ class Writer {
     if (cols.size() != ncols())
       throw JamException("Writer's number of columns (" + std::to_string(ncols()) + ") not equals number of supplied columns (" + std::to_string(cols.size()) + ")");
     
-    size_t nrows =  cols[0].size();
+    size_t nrows = column_size(cols[0]);
     for (const auto& c : cols) {
-      if (c.size() != nrows)
+      if (column_size(c) != nrows)
         throw JamException("All columns must have same length");
     }
 
+    if (rows_per_chunk == 0)
+      rows_per_chunk = MAX_SIZE;
+
+    if (append_) {
+      check_schema(cols);
+      continuation = true;
+    }
+
     size_t chunks = 0;
 
     write_header(continuation);
 
     if (rows_per_chunk >= nrows) {
-      bout_(cols);
+      write_payload(cols, 0, nrows, continuation);
       chunks++;
     } else {
       size_t first = 0, last = rows_per_chunk;
       do {
         if (chunks > 0)
           write_header(true);
-        vector<VarColl> subcols;
-        for (const auto& c : cols) {
-          subcols.push_back(c.subset(first, last));
-        }
-        bout_(subcols);
+        write_payload(cols, first, last, continuation || chunks > 0);
         first = last;
         last = std::min(last + rows_per_chunk, nrows);
         chunks++;
@@ -1084,8 +3032,898 @@ class Writer {
     PRINT("wrote %ld chunks\n", chunks);
     return *this;
   }
+
+ private:
+
+  bool append_ = false;
+  bool closed_ = false;
+  Index index_ = new_index();
+  vector<char> bloom_cols_;
+  double bloom_fpp_ = 0.01;
+
+  static ulong max_chunk_bytes(const Index& index) {
+    ulong out = 1;
+    for (const auto& ch : index.chunks)
+      out = std::max(out, ch.nbytes);
+    return out;
+  }
+
+  void check_compatible(const Description& desc) {
+    if (index_.chunks.empty() && !append_ && meta.find("names") == meta.end()) {
+      meta = desc.meta;
+      col_metas = desc.col_metas;
+      return;
+    }
+    auto names = meta.find("names");
+    if (desc.col_metas.size() != ncols() || names == meta.end() ||
+        names->second.str_vec_val != desc.names)
+      throw JamException("Column names don't match column names of the archive");
+    if (index_.chunks.size() > 0 && (index_.col_types != desc.index.col_types ||
+                                     index_.coll_types != desc.index.coll_types))
+      throw JamException("Column types don't match column types of the archive");
+    for (size_t c = 0; c < ncols(); c++) {
+      // factor codes are meaningful only with respect to the base levels
+      auto old_levels = col_metas[c].find("levels");
+      auto new_levels = desc.col_metas[c].find("levels");
+      bool has_old = old_levels != col_metas[c].end();
+      bool has_new = new_levels != desc.col_metas[c].end();
+      if (has_old != has_new ||
+          (has_old && old_levels->second.str_vec_val != new_levels->second.str_vec_val))
+        throw JamException("Levels of column '" + desc.names[c] + "' don't match levels of the archive");
+    }
+  }
+
+  static Index new_index() {
+    Index index;
+    index.has_crc = true;
+    index.has_zones = true;
+    return index;
+  }
+
+  static std::ofstream open_stream(const string& path, bool append) {
+    if (append) {
+      std::ifstream in(path, std::ios::binary | std::ios::ate);
+      if (in.is_open() && in.tellg() > 0)
+        return std::ofstream(path, std::ios::binary | std::ios::in | std::ios::out);
+    }
+    return std::ofstream(path, std::ios::binary);
+  }
+
+  void init_append() {
+    ostream_.seekp(0, std::ios::end);
+    if (ostream_.tellp() <= 0) {
+      // nothing to append to
+      append_ = false;
+      return;
+    }
+    ulong end = ostream_.tellp();
+    Reader reader(path);
+    reader.fetch_header();
+    meta = reader.meta;
+    col_metas = reader.col_metas;
+    index_ = reader.fetch_index();
+    ulong footer = reader.footer_offset();
+    if (index_.bloom_offset > 0) {
+      // filters are rewritten together with the footer
+      for (size_t i = 0; i < index_.chunks.size(); i++) {
+        ChunkInfo& chunk = index_.chunks[i];
+        chunk.blooms.resize(chunk.bloom_refs.size());
+        for (size_t c = 0; c < chunk.bloom_refs.size(); c++) {
+          chunk.blooms[c] = reader.read_bloom(i, c);
+          // keep filtering the same columns in appended chunks
+          if (!chunk.blooms[c].empty()) {
+            bloom_cols_.resize(std::max(bloom_cols_.size(), c + 1), 0);
+            bloom_cols_[c] = 1;
+          }
+        }
+      }
+      footer = index_.bloom_offset;
+    }
+    if (footer == 0) {
+      // Without a footer the index was recovered by a scan. Drop whatever
+      // follows the last complete chunk (e.g. a footer torn by a crash in
+      // close()) such that readers don't stop at it.
+      footer = end;
+      if (index_.chunks.size() > 0)
+        footer = index_.chunks.back().offset + index_.chunks.back().nbytes;
+      if (footer < end)
+        truncate_file(path, footer);
+    }
+    ostream_.seekp(footer);
+  }
+
+  static void truncate_file(const string& path, ulong size) {
+#ifdef _WIN32
+    int fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+    bool ok = fd >= 0 && _chsize_s(fd, size) == 0;
+    if (fd >= 0)
+      _close(fd);
+#else
+    bool ok = truncate(path.c_str(), size) == 0;
+#endif
+    if (!ok)
+      throw JamException("Cannot truncate file '" + path + "'");
+  }
+
+  template<class Col>
+  void build_blooms(const vector<Col>& cols, size_t first, size_t last, ChunkInfo& info) {
+    info.blooms.resize(cols.size());
+    for (size_t c = 0; c < cols.size() && c < bloom_cols_.size(); c++) {
+      if (bloom_cols_[c]) {
+        vector<ulong> hashes;
+        hashes.reserve(last - first);
+        column_hashes(cols[c], first, last, hashes);
+        info.blooms[c] = BloomFilter(std::move(hashes), bloom_fpp_);
+      }
+    }
+  }
+
+  // BLOOMS = HEAD(BLOOM) SIZE FILTER... Filters are ordered by column.
+  void write_blooms() {
+    size_t ncols = 0;
+    for (const auto& chunk : index_.chunks)
+      ncols = std::max(ncols, chunk.blooms.size());
+    vector<vector<string>> packed(ncols, vector<string>(index_.chunks.size()));
+    ulong size = 0;
+    for (size_t c = 0; c < ncols; c++) {
+      for (size_t i = 0; i < index_.chunks.size(); i++) {
+        const ChunkInfo& chunk = index_.chunks[i];
+        if (c < chunk.blooms.size() && !chunk.blooms[c].empty()) {
+          packed[c][i] = Index::pack(chunk.blooms[c]);
+          size += packed[c][i].size();
+        }
+      }
+    }
+    if (size == 0) {
+      index_.bloom_offset = 0;
+      return;
+    }
+    index_.bloom_offset = ostream_.tellp();
+    bout_(Head(BLOOM, MIXED));
+    bout_(cereal::make_size_tag(static_cast<cereal::size_type>(size)));
+    for (size_t c = 0; c < ncols; c++) {
+      for (size_t i = 0; i < index_.chunks.size(); i++) {
+        ChunkInfo& chunk = index_.chunks[i];
+        chunk.bloom_refs.resize(ncols);
+        chunk.bloom_refs[c].offset = ostream_.tellp();
+        chunk.bloom_refs[c].nbytes = packed[c][i].size();
+        if (packed[c][i].size() > 0)
+          bout_(cereal::binary_data(packed[c][i].data(), packed[c][i].size()));
+      }
+    }
+  }
+
+  template<class Col>
+  void check_schema(const vector<Col>& cols) {
+    if (index_.col_types.size() == 0)
+      return;
+    if (cols.size() != index_.col_types.size())
+      throw JamException("Number of appended columns (" + std::to_string(cols.size()) +
+                         ") doesn't match number of columns in the archive (" +
+                         std::to_string(index_.col_types.size()) + ")");
+    for (size_t c = 0; c < cols.size(); c++) {
+      if (column_type(cols[c]) != index_.col_types[c])
+        throw JamException("Appended column " + std::to_string(c) + " type (" + Type2String(column_type(cols[c])) +
+                           ") doesn't match archive type (" + Type2String(index_.col_types[c]) + ")");
+      if (column_coll_type(cols[c]) != index_.coll_type(c))
+        throw JamException("Appended column " + std::to_string(c) + " is a " + Type2String(column_coll_type(cols[c])) +
+                           " but archive column is a " + Type2String(index_.coll_type(c)));
+    }
+  }
+
+  // Same layout as serialization of vector<VarColl> of subsets.
+  template<class Col>
+  void write_payload(const vector<Col>& cols, size_t first, size_t last, bool continuation) {
+    ChunkInfo info;
+    {
+      StatsTimer timer(stats.encode_time);
+      if (index_.has_zones)
+        for (const auto& c : cols)
+          info.zones.push_back(column_zone(c, first, last));
+      if (bloom_cols_.size() > 0)
+        build_blooms(cols, first, last, info);
+    }
+    info.offset = ostream_.tellp();
+    crcbuf_.reset();
+    // serialization (string translation, narrowing) is encoding; only
+    // forwarding of its output to the file is I/O
+    double io_time = 0;
+    {
+      StatsTimer timer(stats.encode_time);
+      TimedOStreambuf buf(&crcbuf_, io_time);
+      std::ostream out(&buf);
+      BOUT bout(out);
+      bout(cereal::make_size_tag(static_cast<cereal::size_type>(cols.size())));
+      ulong pos = buf.nbytes();
+      for (const auto& c : cols) {
+        serialize_column(bout, c, first, last);
+        stats.add(column_type(c), last - first, buf.nbytes() - pos);
+        pos = buf.nbytes();
+      }
+      if (buf.pubsync() != 0)
+        throw JamException("Cannot write chunk to '" + path + "'");
+    }
+    stats.encode_time -= io_time;
+    stats.io_time += io_time;
+    stats.objects++;
+    info.nbytes = (ulong) ostream_.tellp() - info.offset;
+    info.nrows = last - first;
+    info.continuation = continuation;
+    info.crc = crcbuf_.crc();
+    if (index_.chunks.size() == 0) {
+      index_.col_types.clear();
+      vector<Type> colls;
+      for (const auto& c : cols) {
+        index_.col_types.push_back(column_type(c));
+        colls.push_back(column_coll_type(c));
+      }
+      index_.set_coll_types(colls);
+    }
+    index_.chunks.push_back(info);
+  }
+
+  void write_footer() {
+    write_blooms();
+    ulong offset = ostream_.tellp();
+    Head ihead(JAM_INDEX_HEAD);
+    strmap<string> sections = index_.sections();
+    ihead.crcbit(index_.has_crc);
+    ihead.extbit(sections.size() > 0);
+    bout_(ihead);
+    bout_(index_);
+    if (index_.has_crc)
+      bout_(index_.crcs());
+    if (sections.size() > 0)
+      bout_(sections);
+    bout_(offset, JAR_INDEX_MAGIC);
+  }
   
 };
+
+
+/* ------------------------------------------------------ */
+/* MAPPED ARCHIVES                                        */
+/* ------------------------------------------------------ */
+
+// Read-only view of a whole file. Mapped where mmap is available. Pass
+// `sequential = false` for random access.
+class MappedFile {
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  string buf_;
+#endif
+
+ public:
+
+  explicit MappedFile(const string& path, bool sequential = true) {
+#ifdef _WIN32
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+      throw JamException("Cannot open file '" + path + "'");
+    buf_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    data_ = buf_.data();
+    size_ = buf_.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw JamException("Cannot open file '" + path + "'");
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      throw JamException("Cannot stat file '" + path + "'");
+    }
+    size_ = st.st_size;
+    if (size_ > 0) {
+      void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        close(fd);
+        throw JamException("Cannot map file '" + path + "'");
+      }
+      if (sequential)
+        madvise(p, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char*>(p);
+    }
+    close(fd);
+#endif
+  }
+
+  ~MappedFile() {
+#ifndef _WIN32
+    if (data_)
+      munmap(const_cast<char*>(data_), size_);
+#endif
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* begin() const { return data_; }
+  const char* end() const { return data_ + size_; }
+  size_t size() const { return size_; }
+};
+
+
+
+// Element type of C++ types
+template<class T>
+inline Type jam_type() { return UNDEFINED; }
+
+#define JAM_TYPE(T, JT) template<>               \
+  inline Type jam_type<T>() { return JT; }       \
+
+JAM_TYPE(byte, BYTE)
+JAM_TYPE(ubyte, UBYTE)
+JAM_TYPE(short, SHORT)
+JAM_TYPE(ushort, USHORT)
+JAM_TYPE(int, INT)
+JAM_TYPE(uint, UINT)
+JAM_TYPE(int64_t, LONG)
+JAM_TYPE(ulong, ULONG)
+JAM_TYPE(float, FLOAT)
+JAM_TYPE(double, DOUBLE)
+
+// Object of a mapped jam archive. Only heads, attributes and length prefixes
+// are decoded; `data` points into the mapping.
+struct MappedObject {
+
+  Head head;
+  ulong length = 0;             // number of elements of VECTORs and LISTs
+  const char* data = nullptr;   // VECTOR data (nchars of UTF8 vectors)
+  const char* chars = nullptr;  // concatenated strings of UTF8 vectors
+  Type nchar_type = UNDEFINED;  // element type of nchars of UTF8 vectors
+  str_vec attr_names;
+  vector<MappedObject> attrs;
+  vector<MappedObject> elements;
+
+  const MappedObject* attribute(const string& name) const {
+    for (size_t i = 0; i < attr_names.size() && i < attrs.size(); i++)
+      if (attr_names[i] == name)
+        return &attrs[i];
+    return nullptr;
+  }
+
+  str_vec names() const {
+    const MappedObject* names = attribute("names");
+    return names ? names->strings() : str_vec();
+  }
+
+  const MappedObject& operator[](size_t i) const {
+    if (i >= elements.size())
+      throw JamException("Element " + std::to_string(i) + " out of bounds");
+    return elements[i];
+  }
+
+  const MappedObject& operator[](const string& name) const {
+    str_vec nms = names();
+    for (size_t i = 0; i < nms.size() && i < elements.size(); i++)
+      if (nms[i] == name)
+        return elements[i];
+    throw JamException("No element named '" + name + "'");
+  }
+
+  // View of the data of a VECTOR of element type T (or of packed bytes of a
+  // BOOL vector with T = ubyte). Data of archives written without alignment
+  // can be viewed only when it happens to be suitably aligned for T.
+  template<class T>
+  ColumnView<T> view() const {
+    Type type = jam_type<T>();
+    bool packed = head.el_type == BOOL && type == UBYTE;
+    if (head.coll_type != VECTOR || (head.el_type != type && !packed))
+      throw JamException("Cannot view " + Type2String(head.coll_type) + " of type " +
+                         Type2String(head.el_type) + " as " + Type2String(type));
+    if (reinterpret_cast<uintptr_t>(data) % alignof(T) != 0)
+      throw JamException("Unaligned " + Type2String(head.el_type) +
+                         " vector; write the archive with alignment");
+    return ColumnView<T>(reinterpret_cast<const T*>(data), packed ? (length + 1)/2 : length);
+  }
+
+  // Copy of a UTF8 or STRING vector. NA strings are "NA".
+  str_vec strings() const {
+    if (head.coll_type != VECTOR || (head.el_type != UTF8 && head.el_type != STRING))
+      throw JamException("Cannot read strings of " + Type2String(head.el_type) + " vector");
+    str_vec out;
+    out.reserve(length);
+    const char* p = head.el_type == UTF8 ? chars : data;
+    for (ulong i = 0; i < length; i++) {
+      long n;
+      if (head.el_type == STRING) {
+        cereal::size_type len;
+        std::memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        n = len;
+      } else {
+        n = nchar(i);
+      }
+      if (n < 0) {
+        out.push_back("NA");
+      } else {
+        out.emplace_back(p, n);
+        p += n;
+      }
+    }
+    return out;
+  }
+
+ private:
+
+  long nchar(ulong i) const {
+    switch (nchar_type) {
+     case BYTE:  { byte n;  std::memcpy(&n, data + i, 1); return n; }
+     case SHORT: { short n; std::memcpy(&n, data + 2*i, 2); return n; }
+     case INT:   { int n;   std::memcpy(&n, data + 4*i, 4); return n; }
+     default:
+       throw JamException("Invalid nchar type " + Type2String(nchar_type));
+    }
+  }
+};
+
+// Jam archive mapped into memory. Opening walks the heads and length
+// prefixes of all objects while data is left on disk until it is accessed
+// through views. REF records of deduplicated archives resolve to copies of
+// the referenced object, viewing the same data. Archives written with
+// `aligned` layout have all data buffers on 64-byte boundaries:
+//
+//   MappedArchive ar("df.rjam");
+//   ColumnView<double> x = ar.root()["x"].view<double>();
+//   double sum = std::accumulate(x.begin(), x.end(), 0.0);
+class MappedArchive {
+
+  MappedFile file_;
+  MemStreambuf buf_;
+  std::istream in_;
+  cereal::BinaryInputArchive bin_;
+  MappedObject root_;
+  bool has_refs_ = false;
+  vector<MappedObject> refs_; // objects numbered for REF records
+
+ public:
+
+  explicit MappedArchive(const string& path) :
+    file_(path, false),
+    buf_(file_.begin(), file_.size()),
+    in_(&buf_),
+    bin_(in_)
+  {
+    try {
+      Head head;
+      bin_(head);
+      has_refs_ = head.refbit();
+      root_ = object(head);
+    } catch (cereal::Exception& e) {
+      throw JamException("Truncated jam archive '" + path + "'");
+    }
+  }
+
+  MappedArchive(const MappedArchive&) = delete;
+  MappedArchive& operator=(const MappedArchive&) = delete;
+
+  const MappedObject& root() const { return root_; }
+  const char* begin() const { return file_.begin(); }
+  size_t size() const { return file_.size(); }
+
+ private:
+
+  const char* pos() {
+    return file_.begin() + stream_pos(&buf_);
+  }
+
+  void skip(ulong n) {
+    if (n > static_cast<ulong>(file_.end() - pos()))
+      throw JamException("Truncated jam archive");
+    buf_.pubseekoff(n, std::ios::cur, std::ios::in);
+  }
+
+  ulong size_tag() {
+    cereal::size_type n;
+    bin_(cereal::make_size_tag(n));
+    return n;
+  }
+
+  // Skip buffer of fixed size elements. Return its length and set `data`.
+  ulong buffer(const Head& head, size_t el_size, const char*& data) {
+    if (head.aligned()) {
+      ubyte npad;
+      bin_(npad);
+      if (npad >= JAM_ALIGNMENT)
+        throw JamException("Invalid padding in jam archive");
+      skip(npad);
+    }
+    ulong n = size_tag();
+    data = pos();
+    if (el_size > 0 && n > static_cast<ulong>(file_.end() - data) / el_size)
+      throw JamException("Truncated jam archive");
+    skip(n * el_size);
+    return n;
+  }
+
+  void vector_tail(MappedObject& out) {
+    const Head& head = out.head;
+    switch (head.el_type) {
+     case BOOL:
+       {
+         ulong n = buffer(head, 1, out.data);
+         out.length = (n > 0 && (out.data[n-1] & 12) == 12) ? n*2 - 1 : n*2;
+       }
+       break;
+     case STRING:
+       {
+         const char* first;
+         out.length = buffer(head, 0, first);
+         out.data = first;
+         for (ulong i = 0; i < out.length; i++)
+           skip(size_tag());
+       }
+       break;
+     case UTF8:
+       {
+         Head nchar_head;
+         bin_(nchar_head);
+         out.nchar_type = nchar_head.el_type;
+         out.length = buffer(head, type_size(out.nchar_type), out.data);
+         buffer(head, 1, out.chars);
+       }
+       break;
+     default:
+       out.length = buffer(head, type_size(head.el_type), out.data);
+    }
+    if (head.crcbit())
+      skip(sizeof(uint));
+  }
+
+  void list_tail(MappedObject& out) {
+    const Head& head = out.head;
+    if (head.longbit()) {
+      ulong n;
+      bin_(n);
+      out.length = n;
+    } else {
+      uint n;
+      bin_(n);
+      out.length = n;
+    }
+    if (out.length == 0)
+      return;
+    out.elements.reserve(std::min<ulong>(out.length, file_.end() - pos()));
+    switch (head.el_type) {
+     case MIXED:
+       for (ulong i = 0; i < out.length; i++)
+         out.elements.push_back(object());
+       break;
+     case VECTOR:
+       {
+         Head common_head;
+         bin_(common_head);
+         for (ulong i = 0; i < out.length; i++)
+           out.elements.push_back(object(common_head));
+       }
+       break;
+     default:
+       throw JamException("Element type of LISTs can only be VECTOR or MIXED");
+    }
+  }
+
+  MappedObject object(const Head& head) {
+    MappedObject out;
+    out.head = head;
+    if (head.metabit()) {
+      bin_(out.attr_names);
+      MappedObject meta;
+      meta.head = JAM_META_HEAD;
+      list_tail(meta);
+      out.attrs = std::move(meta.elements);
+    }
+    switch (head.coll_type) {
+     case NIL:
+       break;
+     case VECTOR:
+       vector_tail(out);
+       break;
+     case META:
+     case LIST:
+       list_tail(out);
+       break;
+     case REF:
+       {
+         ulong id;
+         bin_(id);
+         if (id >= refs_.size())
+           throw JamException("Invalid reference in jam archive");
+         return refs_[id];
+       }
+     default:
+       throw JamException("Unsupported type in jam head (" + Type2String(head.coll_type) + ")");
+    }
+    if (has_refs_ && head.coll_type != NIL)
+      refs_.push_back(out);
+    return out;
+  }
+
+  MappedObject object() {
+    Head head;
+    bin_(head);
+    return object(head);
+  }
+};
+
+/* ------------------------------------------------------ */
+/* EXTERNAL SORT                                          */
+/* ------------------------------------------------------ */
+
+// Order of rows i of `a` and j of `b` by columns `by`. NAs sort last, as in
+// R's order(). Strings are compared bytewise (C locale); NA strings are
+// stored as "NA" and sort as such.
+inline int compare_rows(const vector<VarColl>& a, size_t i,
+                        const vector<VarColl>& b, size_t j,
+                        const vector<size_t>& by) {
+  for (size_t c : by) {
+    const VarColl& x = a[c];
+    const VarColl& y = b[c];
+    switch (x.el_type) {
+     case INT: {
+       int u = x.int_vec_val[i], v = y.int_vec_val[j];
+       if (u == v) continue;
+       if (u == NA_INT) return 1;
+       if (v == NA_INT) return -1;
+       return u < v ? -1 : 1;
+     }
+     case LONG: {
+       int64_t u = x.long_vec_val[i], v = y.long_vec_val[j];
+       if (u == v) continue;
+       if (u == NA_LONG) return 1;
+       if (v == NA_LONG) return -1;
+       return u < v ? -1 : 1;
+     }
+     case DOUBLE: {
+       double u = x.dbl_vec_val[i], v = y.dbl_vec_val[j];
+       bool nu = std::isnan(u), nv = std::isnan(v);
+       if (nu || nv) {
+         if (nu && nv) continue;
+         return nu ? 1 : -1;
+       }
+       if (u == v) continue;
+       return u < v ? -1 : 1;
+     }
+     case STRING: {
+       int cmp = x.str_vec_val[i].compare(y.str_vec_val[j]);
+       if (cmp == 0) continue;
+       return cmp < 0 ? -1 : 1;
+     }
+     default:
+       throw JamException("Cannot sort by columns of type " + Type2String(x.el_type));
+    }
+  }
+  return 0;
+}
+
+inline size_t columns_nbytes(const vector<VarColl>& cols) {
+  size_t n = 0;
+  for (const auto& c : cols) n += c.nbytes();
+  return n;
+}
+
+inline size_t columns_nrows(const vector<VarColl>& cols) {
+  return cols.size() > 0 ? cols[0].size() : 0;
+}
+
+// Sort jar `in` by columns `by` into jar `out` holding at most about `memory`
+// bytes of decoded rows at once. Rows are accumulated into runs of about
+// memory/2 bytes, each run is sorted in memory and spilled into a temporary
+// jar `tmp_prefix<N>`, and the runs are k-way merged. Runs are written in
+// small chunks so that the merge can stream up to SORT_FAN_IN of them at
+// once; more runs are merged in several passes. The sort is stable. Meta of
+// the input and its Bloom filter columns are carried over to the output.
+// Input chunks larger than the budget are read whole.
+class Sorter {
+
+  static const size_t SORT_FAN_IN = 32;
+
+  string in_;
+  string out_;
+  vector<size_t> by_;
+  size_t memory_;
+  string tmp_prefix_;
+  size_t rows_per_chunk_;
+  size_t nruns_ = 0;
+
+  strmap<VarColl> meta_;
+  vector<strmap<VarColl>> col_metas_;
+  vector<size_t> bloom_cols_;
+
+  // Rows of a run file, consumed chunk by chunk
+  struct Cursor {
+    Reader reader;
+    vector<VarColl> cols;
+    size_t pos = 0;
+    size_t run;
+    Cursor(const string& path, size_t run) : reader(path), run(run) {}
+    bool next() {
+      if (++pos < columns_nrows(cols))
+        return true;
+      cols = reader.read_columns(1);
+      pos = 0;
+      return columns_nrows(cols) > 0;
+    }
+  };
+
+ public:
+
+  Stats stats;
+
+  Sorter(const string& in, const string& out, const vector<size_t>& by,
+         size_t memory, const string& tmp_prefix, size_t rows_per_chunk = 0) :
+    in_(in), out_(out), by_(by), memory_(std::max<size_t>(memory, 1 << 20)),
+    tmp_prefix_(tmp_prefix), rows_per_chunk_(rows_per_chunk) {}
+
+  void run() {
+    vector<string> runs = spill_runs();
+    if (runs.empty())
+      return;
+    while (runs.size() > SORT_FAN_IN) {
+      vector<string> merged;
+      for (size_t i = 0; i < runs.size(); i += SORT_FAN_IN) {
+        vector<string> group(runs.begin() + i, runs.begin() + std::min(runs.size(), i + SORT_FAN_IN));
+        if (group.size() == 1) {
+          merged.push_back(group[0]);
+          continue;
+        }
+        string path = run_path();
+        Writer writer(path, meta_, col_metas_);
+        merge(group, writer, run_rows_);
+        writer.close();
+        merged.push_back(path);
+      }
+      runs = merged;
+    }
+    Writer writer(out_, meta_, col_metas_);
+    writer.bloom(bloom_cols_);
+    merge(runs, writer, out_rows_);
+    writer.close();
+    stats.merge(writer.stats);
+  }
+
+ private:
+
+  size_t run_rows_ = 1;  // rows per chunk of temporary runs
+  size_t out_rows_ = 1;  // rows per chunk of the output
+
+  string run_path() {
+    return tmp_prefix_ + std::to_string(nruns_++);
+  }
+
+  // Read the input and write sorted runs. If the input fits into one run it
+  // is written straight into the output.
+  vector<string> spill_runs() {
+    Reader reader(in_);
+    const Index& index = reader.fetch_index();
+    reader.fetch_header();
+    meta_ = reader.meta;
+    col_metas_ = reader.col_metas;
+    for (const auto& ch : index.chunks)
+      for (size_t c = 0; c < ch.bloom_refs.size(); c++)
+        if (ch.bloom_refs[c].nbytes > 0 &&
+            std::find(bloom_cols_.begin(), bloom_cols_.end(), c) == bloom_cols_.end())
+          bloom_cols_.push_back(c);
+    for (size_t c : by_) {
+      if (c >= col_metas_.size())
+        throw JamException("Sort column " + std::to_string(c) + " is out of range");
+      if (index.coll_type(c) != VECTOR)
+        throw JamException("Cannot sort by LIST column " + std::to_string(c));
+    }
+
+    vector<string> runs;
+    vector<VarColl> run;
+    bool init_sizes = true;
+    while (true) {
+      vector<VarColl> chunk = reader.read_columns(1);
+      bool done = chunk.empty();
+      if (!done && run.empty()) {
+        run = std::move(chunk);
+      } else if (!done) {
+        for (size_t c = 0; c < run.size(); c++)
+          run[c].append(chunk[c], 0, chunk[c].size());
+      }
+      size_t nbytes = columns_nbytes(run);
+      if (columns_nrows(run) > 0 && (done || nbytes >= memory_ / 2)) {
+        if (init_sizes) {
+          // size chunks by the average row of the first run
+          size_t row_bytes = std::max<size_t>(1, nbytes / columns_nrows(run));
+          run_rows_ = std::max<size_t>(1, memory_ / 4 / SORT_FAN_IN / row_bytes);
+          out_rows_ = std::max<size_t>(1, std::min(rows_per_chunk_ > 0 ? rows_per_chunk_ : MAX_SIZE,
+                                                   memory_ / 4 / row_bytes));
+          init_sizes = false;
+        }
+        run = sort_columns(std::move(run));
+        if (done && runs.empty()) {
+          Writer writer(out_, meta_, col_metas_);
+          writer.bloom(bloom_cols_);
+          writer.write_columns(run, out_rows_);
+          writer.close();
+          stats.merge(writer.stats);
+          break;
+        }
+        runs.push_back(run_path());
+        Writer writer(runs.back(), meta_, col_metas_);
+        writer.write_columns(run, run_rows_);
+        writer.close();
+        run.clear();
+      }
+      if (done) break;
+    }
+    stats.merge(reader.stats);
+    if (init_sizes) {
+      if (run.empty())
+        throw JamException("Cannot sort an empty archive");
+      // zero rows
+      Writer writer(out_, meta_, col_metas_);
+      writer.write_columns(run);
+    }
+    return runs;
+  }
+
+  vector<VarColl> sort_columns(vector<VarColl> cols) {
+    StatsTimer timer(stats.encode_time);
+    vector<size_t> idx(columns_nrows(cols));
+    for (size_t i = 0; i < idx.size(); i++) idx[i] = i;
+    std::stable_sort(idx.begin(), idx.end(), [&](size_t i, size_t j) {
+        return compare_rows(cols, i, cols, j, by_) < 0;
+      });
+    for (auto& c : cols)
+      c = c.take(idx);
+    return cols;
+  }
+
+  // All but the first chunk share the base header
+  static void write_chunk(Writer& writer, const vector<VarColl>& cols) {
+    writer.write_columns(cols, MAX_SIZE, writer.index().chunks.size() > 0);
+  }
+
+  // Merge sorted `runs` into `writer` in chunks of `rows` rows and delete
+  // the runs. Ties are resolved by run order, which keeps the sort stable.
+  void merge(const vector<string>& runs, Writer& writer, size_t rows) {
+    vector<std::unique_ptr<Cursor>> cursors;
+    for (size_t r = 0; r < runs.size(); r++) {
+      cursors.emplace_back(new Cursor(runs[r], r));
+      if (!cursors.back()->next())
+        cursors.pop_back();
+    }
+    auto greater = [&](const Cursor* a, const Cursor* b) {
+      int cmp = compare_rows(a->cols, a->pos, b->cols, b->pos, by_);
+      return cmp > 0 || (cmp == 0 && a->run > b->run);
+    };
+    vector<Cursor*> heap;
+    for (auto& c : cursors) heap.push_back(c.get());
+    std::make_heap(heap.begin(), heap.end(), greater);
+
+    vector<VarColl> buf;
+    while (!heap.empty()) {
+      std::pop_heap(heap.begin(), heap.end(), greater);
+      Cursor* top = heap.back();
+      if (buf.empty())
+        for (const auto& c : top->cols)
+          buf.push_back(VarColl(c.coll_type, c.el_type));
+      for (size_t c = 0; c < buf.size(); c++)
+        buf[c].append(top->cols[c], top->pos, top->pos + 1);
+      if (columns_nrows(buf) >= rows) {
+        write_chunk(writer, buf);
+        buf.clear();
+      }
+      if (top->next())
+        std::push_heap(heap.begin(), heap.end(), greater);
+      else
+        heap.pop_back();
+    }
+    if (columns_nrows(buf) > 0)
+      write_chunk(writer, buf);
+    for (auto& c : cursors)
+      stats.merge(c->reader.stats);
+    cursors.clear();
+    for (const auto& r : runs)
+      std::remove(r.c_str());
+  }
+
+};
 }
 
 #endif
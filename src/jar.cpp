@@ -1,4 +1,5 @@
 #include "rutils.hpp"
+#include <cstring>
 
 
 /* ------------------------------------------------------ */
@@ -8,9 +9,9 @@
 #define DEFSEXP2CPP(NAME, TYPE, EXTRACTOR)          \
   static VarColl NAME(SEXP x){                      \
     SEXP rnames = GET_NAMES(x);                     \
-    R_len_t N = LENGTH(x);                          \
+    R_xlen_t N = XLENGTH(x);                        \
     strmap<TYPE> m;                                 \
-    for (int i = 0; i < N; i++) {                   \
+    for (R_xlen_t i = 0; i < N; i++) {              \
       m[string(CHAR(STRING_ELT(rnames, i)))] =      \
         EXTRACTOR;                                  \
     }                                               \
@@ -34,7 +35,7 @@ static VarColl SEXP2VarColl(SEXP x) {
      case STRSXP:  return strvec2map(x);
      case VECSXP: {
        int ct = common_el_type(x, true);
-       if (LENGTH(x) > 0 && ct > 0) {
+       if (XLENGTH(x) > 0 && ct > 0) {
          switch (TYPEOF(VECTOR_ELT(x, 0))) {
           case LGLSXP:
           case INTSXP:  return intlist2map(x);
@@ -102,10 +103,215 @@ static strmap<VarColl> get_meta(SEXP x) {
 
 
 
+static void check_append_meta(Writer& writer, strmap<VarColl>& meta, vector<strmap<VarColl>>& col_metas) {
+  if (writer.ncols() != col_metas.size())
+    stop("Number of columns (%d) doesn't match number of columns in the archive (%d).",
+         (int) col_metas.size(), (int) writer.ncols());
+  str_vec old_names = writer.meta["names"].get<str_vec>();
+  if (old_names != meta["names"].get<str_vec>())
+    stop("Column names don't match column names in the archive.");
+  for (size_t c = 0; c < col_metas.size(); c++) {
+    // factor codes are meaningful only with respect to the base levels
+    auto old_levels = writer.col_metas[c].find("levels");
+    auto new_levels = col_metas[c].find("levels");
+    bool has_old = old_levels != writer.col_metas[c].end();
+    bool has_new = new_levels != col_metas[c].end();
+    if (has_old != has_new ||
+        (has_old && old_levels->second.str_vec_val != new_levels->second.str_vec_val))
+      stop("Levels of column '%s' don't match levels in the archive.", old_names[c].c_str());
+  }
+}
+
+
 /* ------------------------------------------------------ */
 /* SERIALIZATION                                          */
 /* ------------------------------------------------------ */
 
+// Column view of a data.frame column for the Writer. Chunks are serialized
+// straight from R memory in the same layout as VarColl vectors and lists.
+struct SexpColumn {
+  SEXP x;
+  Type el_type;
+  Type coll_type;
+};
+
+// Common element type of the atomic vectors of a list column; logical
+// elements are stored as integers
+static Type list_el_type(SEXP x) {
+  Type out = INT;
+  for (R_xlen_t i = 0; i < XLENGTH(x); i++) {
+    SEXP el = VECTOR_ELT(x, i);
+    Type type;
+    switch (TYPEOF(el)) {
+     case LGLSXP:
+     case INTSXP:  type = INT; break;
+     case REALSXP: type = is_integer64(el) ? LONG : DOUBLE; break;
+     case STRSXP:  type = STRING; break;
+     default:
+       stop("Cannot jar list columns with elements of type %s", Rf_type2char(TYPEOF(el)));
+    }
+    if (i > 0 && type != out)
+      stop("Elements of list columns must be of the same type.");
+    out = type;
+  }
+  return out;
+}
+
+static SexpColumn as_column(SEXP x) {
+  switch (TYPEOF(x)) {
+   case LGLSXP:
+   case INTSXP:  return SexpColumn {x, INT, VECTOR};
+   case REALSXP: return SexpColumn {x, is_integer64(x) ? LONG : DOUBLE, VECTOR};
+   case STRSXP:  return SexpColumn {x, STRING, VECTOR};
+   case VECSXP:  return SexpColumn {x, list_el_type(x), LIST};
+   default:
+     stop("Cannot jar columns of type %s", Rf_type2char(TYPEOF(x)));
+  }
+}
+
+inline size_t column_size(const SexpColumn& col) {
+  return XLENGTH(col.x);
+}
+
+inline Type column_type(const SexpColumn& col) {
+  return col.el_type;
+}
+
+inline Type column_coll_type(const SexpColumn& col) {
+  return col.coll_type;
+}
+
+// Elements [first, last) of atomic vector `x` without a size tag
+static void serialize_values(BOUT& bout, SEXP x, Type el_type, size_t first, size_t last) {
+  size_t n = last - first;
+  switch (el_type) {
+   case INT: {
+     int* px = (TYPEOF(x) == LGLSXP) ? LOGICAL(x) : INTEGER(x);
+     bout(cereal::binary_data(px + first, n * sizeof(int)));
+     break;
+   }
+   case LONG:
+     bout(cereal::binary_data(INTEGER64(x) + first, n * sizeof(int64_t)));
+     break;
+   case DOUBLE:
+     bout(cereal::binary_data(REAL(x) + first, n * sizeof(double)));
+     break;
+   case STRING: {
+     // translations are R_alloc'ed; release them once the range is written
+     const void* vmax = vmaxget();
+     for (size_t i = first; i < last; i++) {
+       SEXP str = STRING_ELT(x, i);
+       // as<str_vec> used to store NAs as "NA"
+       const char* ch = (str == R_NaString) ? "NA" : Rf_translateCharUTF8(str);
+       size_t len = strlen(ch);
+       bout(cereal::make_size_tag(static_cast<cereal::size_type>(len)));
+       bout(cereal::binary_data(ch, len));
+     }
+     vmaxset(vmax);
+     break;
+   }
+   default:
+     stop_on_invalid_type(x, el_type);
+  }
+}
+
+inline void serialize_column(BOUT& bout, const SexpColumn& col, size_t first, size_t last) {
+  size_t n = last - first;
+  bout(col.coll_type, col.el_type);
+  if (col.coll_type == LIST) {
+    // offsets of rows [first, last) into their flat values, then the values
+    bout(cereal::make_size_tag(static_cast<cereal::size_type>(n + 1)));
+    ulong offset = 0;
+    bout(offset);
+    for (size_t i = first; i < last; i++) {
+      offset += XLENGTH(VECTOR_ELT(col.x, i));
+      bout(offset);
+    }
+    bout(cereal::make_size_tag(static_cast<cereal::size_type>(offset)));
+    for (size_t i = first; i < last; i++) {
+      SEXP el = VECTOR_ELT(col.x, i);
+      serialize_values(bout, el, col.el_type, 0, XLENGTH(el));
+    }
+  } else {
+    bout(cereal::make_size_tag(static_cast<cereal::size_type>(n)));
+    serialize_values(bout, col.x, col.el_type, first, last);
+  }
+}
+
+inline ZoneMap column_zone(const SexpColumn& col, size_t first, size_t last) {
+  if (col.coll_type != VECTOR)
+    return ZoneMap();
+  switch (col.el_type) {
+   case INT: {
+     int* px = (TYPEOF(col.x) == LGLSXP) ? LOGICAL(col.x) : INTEGER(col.x);
+     return numeric_zone(px + first, last - first);
+   }
+   case LONG:
+     return numeric_zone(INTEGER64(col.x) + first, last - first);
+   case DOUBLE:
+     return numeric_zone(REAL(col.x) + first, last - first);
+   case STRING: {
+     // NAs are stored as "NA" and take part in the range; the bounds are
+     // copied out of the translations before these are released
+     const void* vmax = vmaxget();
+     ZoneMap z = string_zone(last - first, [&](size_t i) {
+         SEXP str = STRING_ELT(col.x, first + i);
+         const char* ch = (str == R_NaString) ? "NA" : Rf_translateCharUTF8(str);
+         return std::make_pair(ch, strlen(ch));
+       });
+     vmaxset(vmax);
+     return z;
+   }
+   default:
+     return ZoneMap();
+  }
+}
+
+// NAs of STRING columns are stored as "NA" and are hashed as such
+inline void column_hashes(const SexpColumn& col, size_t first, size_t last, vector<ulong>& out) {
+  if (col.coll_type != VECTOR)
+    stop("Bloom filters are not supported for list columns.");
+  switch (col.el_type) {
+   case INT: {
+     int* px = (TYPEOF(col.x) == LGLSXP) ? LOGICAL(col.x) : INTEGER(col.x);
+     for (size_t i = first; i < last; i++)
+       if (px[i] != NA_INTEGER)
+         out.push_back(bloom_hash(px[i]));
+     break;
+   }
+   case STRING: {
+     const void* vmax = vmaxget();
+     for (size_t i = first; i < last; i++) {
+       SEXP str = STRING_ELT(col.x, i);
+       const char* ch = (str == R_NaString) ? "NA" : Rf_translateCharUTF8(str);
+       out.push_back(bloom_hash(ch, strlen(ch)));
+     }
+     vmaxset(vmax);
+     break;
+   }
+   default:
+     stop("Bloom filters are supported for integer and character columns only.");
+  }
+}
+
+// Map names of `bloom` columns to their indexes
+static vector<size_t> bloom_columns(SEXP x, const vector<std::string>& bloom) {
+  vector<size_t> out;
+  if (bloom.empty())
+    return out;
+  vector<std::string> names = as<vector<std::string>>(Rf_getAttrib(x, R_NamesSymbol));
+  for (const auto& name : bloom) {
+    size_t c = std::find(names.begin(), names.end(), name) - names.begin();
+    if (c == names.size())
+      stop("Bloom filter column '%s' not found.", name);
+    SexpColumn col = as_column(VECTOR_ELT(x, c));
+    if (col.coll_type != VECTOR || (col.el_type != INT && col.el_type != STRING))
+      stop("Bloom filters are supported for integer and character columns only ('%s').", name);
+    out.push_back(c);
+  }
+  return out;
+}
+
 template<class Tout> inline
 void jar_int_primitive(cereal::BinaryOutputArchive& bout, const int& el, const Tout& na_val) {
   if (el == NA_INTEGER) bout(na_val);
@@ -113,7 +319,7 @@ void jar_int_primitive(cereal::BinaryOutputArchive& bout, const int& el, const T
 }
 
 // [[Rcpp::export]]
-void c_jar(SEXP x, const std::string& path, bool append, int rows_per_chunk) {
+void c_jar(SEXP x, const std::string& path, bool append, int rows_per_chunk, std::vector<std::string> bloom) {
  
   if (!(TYPEOF(x) == VECSXP && Rf_inherits(x, "data.frame"))) {
 
@@ -123,24 +329,46 @@ void c_jar(SEXP x, const std::string& path, bool append, int rows_per_chunk) {
 
     uint ncols = XLENGTH(x);
 
+    vector<size_t> bloom_idx = bloom_columns(x, bloom);
+
     PRINT("-- init writer --\n");
     Writer writer(path, append);
 
-    writer.meta = get_meta(x);
-
+    strmap<VarColl> meta = get_meta(x);
     vector<strmap<VarColl>> col_metas(ncols);
     for (size_t c = 0; c < ncols; c++){
       col_metas[c] = get_meta(VECTOR_ELT(x, c));
     }
-    writer.col_metas = col_metas;
 
-    vector<VarColl> cols;
+    if (writer.appending()) {
+      // continuation chunks share the base header of the archive
+      check_append_meta(writer, meta, col_metas);
+    } else {
+      writer.meta = meta;
+      writer.col_metas = col_metas;
+    }
+    writer.bloom(bloom_idx);
+
+    vector<SexpColumn> cols;
     for (size_t c = 0; c < ncols; c++) {
-      cols.push_back(SEXP2VarColl(VECTOR_ELT(x, c)));
+      cols.push_back(as_column(VECTOR_ELT(x, c)));
     }
     
     PRINT("-- writing columns --\n");
     writer.write_columns(cols, rows_per_chunk);
+    writer.close();
+    last_stats = writer.stats;
   }
 
 }
+
+// [[Rcpp::export]]
+void c_jar_concat(std::vector<std::string> files, const std::string& out) {
+  Writer writer(out);
+  for (const auto& file : files) {
+    Reader reader(file);
+    writer.append_chunks_from(reader);
+  }
+  writer.close();
+  last_stats = writer.stats;
+}
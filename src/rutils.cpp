@@ -1,6 +1,8 @@
 #include "rutils.hpp"
 #include <cstring>
 
+Stats last_stats;
+
 SEXPTYPE Jam2SexpType (Type jtype) {
   switch(jtype) {
    case BOOL:
@@ -47,8 +49,8 @@ Type best_int_type(SEXP x){
     m = 0;
   } else {
     int* pt = INTEGER(x);
-    R_len_t N = XLENGTH(x);
-    for (R_len_t i = 0; i < N; i++) {
+    R_xlen_t N = XLENGTH(x);
+    for (R_xlen_t i = 0; i < N; i++) {
       int v = pt[i];
       if (v != NA_INTEGER){
         M = std::max(M, v);
@@ -66,6 +68,28 @@ Type best_int_type(SEXP x){
 }
 
 
+// Narrowest type holding all non-NA values of integer64 `x` and its NA
+Type best_long_type(SEXP x) {
+  int64_t* pt = INTEGER64(x);
+  R_xlen_t N = XLENGTH(x);
+  int64_t M = MIN_LONG, m = MAX_LONG;
+  for (R_xlen_t i = 0; i < N; i++) {
+    int64_t v = pt[i];
+    if (v != NA_LONG) {
+      M = std::max(M, v);
+      m = std::min(m, v);
+    }
+  }
+  if (m > M) return BYTE; // all NA
+  if (m > MIN_BYTE && M <= MAX_BYTE) return BYTE;
+  if (m >= 0 && M < MAX_UBYTE) return UBYTE;
+  if (m > MIN_SHORT && M <= MAX_SHORT) return SHORT;
+  if (m >= 0 && M < MAX_USHORT) return USHORT;
+  if (m > MIN_INT && M <= MAX_INT) return INT;
+  if (m >= 0 && M < MAX_UINT) return UINT;
+  return LONG;
+}
+
 inline int attr_length(const SEXP x) {
   SEXP attr = ATTRIB(x);
   int len = 0;
@@ -87,11 +111,9 @@ Head get_head(SEXP x) {
      if (XLENGTH(x) == 0) {
        return Head(LIST, UNDEFINED);
      } else {
-       if (common_el_type(x) >= 0) {
-         return Head(LIST, VECTOR, has_meta);
-       } else {
-         return Head(LIST, MIXED, has_meta);
-       }
+       Head head(LIST, common_el_type(x) >= 0 ? VECTOR : MIXED, has_meta);
+       head.longbit(XLENGTH(x) > MAX_UINT);
+       return head;
      }
    default:
      Type el_type = Sexp2JamElType(TYPEOF(x));
@@ -124,8 +146,8 @@ SEXP toSEXP(const std::vector<std::string>& vec, SEXPTYPE stype) {
 
   if (stype != STRSXP) stop("Jammer strings can be only converted to R character vector.");
 
-  for (int i = 0; i < n; ++i) {
-    std::string istr = vec[i];
+  for (size_t i = 0; i < n; ++i) {
+    const std::string& istr = vec[i];
     SEXP ostr = Rf_mkCharLenCE(istr.c_str(), istr.size(), CE_UTF8);
     SET_STRING_ELT(out, i, ostr);
   }
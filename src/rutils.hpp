@@ -6,6 +6,8 @@
 #include <fstream>
 #include <iostream>
 #include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <Rcpp.h>
 using namespace Rcpp;
@@ -13,6 +15,52 @@ using namespace Rcpp;
 #include "jam.hpp"
 using namespace jam;
 
+// Binary archives which carry per-call state through jam/unjam recursion.
+
+// When `crcbuf` is set, the stream writes (or reads) through it and vector
+// tails are followed by (checked against) their CRC32C checksum.
+
+// With deduplication objects are numbered in the order their writing (or
+// reading) completes and repeated objects are written as REF records which
+// hold the number of the first occurrence.
+
+enum Dedup {
+  DEDUP_NONE = 0,
+  DEDUP_POINTERS = 1, // objects which are the same R object
+  DEDUP_CONTENT = 2   // also atomic vectors which are identical()
+};
+
+class JamOArchive : public cereal::BinaryOutputArchive {
+ public:
+  std::ostream& stream;
+  CrcOStreambuf* crcbuf;
+  Stats stats;
+  bool aligned = false; // pad data buffers of VECTORs (see JAM_VERSION_ALIGNED)
+  int dedup = DEDUP_NONE;
+  ulong nrefs = 0;
+  std::unordered_map<SEXP, ulong> ref_ids;
+  std::unordered_multimap<uint, SEXP> ref_hashes; // by content (DEDUP_CONTENT)
+  JamOArchive(std::ostream& stream, CrcOStreambuf* crcbuf = nullptr) :
+    cereal::BinaryOutputArchive(stream), stream(stream), crcbuf(crcbuf) {}
+};
+
+class JamIArchive : public cereal::BinaryInputArchive {
+ public:
+  std::istream& stream;
+  CrcIStreambuf* crcbuf;
+  Stats stats;
+  bool aligned = false; // data buffers of the current VECTOR are padded
+  ulong limit = MAX_ULONG; // elements read of each vector or list; the rest is skipped
+  SEXP refs = R_NilValue; // objects read so far when the archive has REF records
+  PROTECT_INDEX refs_index;
+  R_xlen_t nrefs = 0;
+  JamIArchive(std::istream& stream, CrcIStreambuf* crcbuf = nullptr) :
+    cereal::BinaryInputArchive(stream), stream(stream), crcbuf(crcbuf) {}
+};
+
+// Statistics of the last jam, unjam, jar or unjar call
+extern Stats last_stats;
+
 #define GET_NAMES(x) Rf_getAttrib(x, R_NamesSymbol)
 #define GET_DIM(x)   Rf_getAttrib(x, R_DimSymbol)
 
@@ -24,6 +72,19 @@ jam::Type best_int_type(SEXP x);
 
 Head get_head(SEXP x);
 
+// bit64::integer64 vectors are doubles holding 64-bit integer bit patterns
+inline bool is_integer64(SEXP x) {
+  return TYPEOF(x) == REALSXP && Rf_inherits(x, "integer64");
+}
+
+// bit64 stores integer64 values in the payload of a double vector
+static_assert(sizeof(int64_t) == sizeof(double), "integer64 needs 8-byte doubles");
+inline int64_t* INTEGER64(SEXP x) {
+  return reinterpret_cast<int64_t*>(REAL(x));
+}
+
+Type best_long_type(SEXP x);
+
 // Didn't find in R, so roll my own.
 SEXP get_list_elt(SEXP x, const char* name);
 
@@ -49,11 +110,42 @@ inline void stop_on_invalid_type(SEXP x, const Type& jtype) {
        Rf_type2char(TYPEOF(x)), Type2String(jtype));
 }
 
-inline void jam_names(cereal::BinaryOutputArchive& bout, SEXP x) {
+inline void jam_names(JamOArchive& bout, SEXP x) {
   std::vector<std::string> names = as<std::vector<std::string>>(GET_NAMES(x));
   bout(names);
 }
 
+// LIST lengths are 32-bit unless the head has the long bit set
+inline void jam_list_length(JamOArchive& bout, const Head& head, R_xlen_t N) {
+  if (head.longbit()) bout(static_cast<ulong>(N));
+  else bout(static_cast<uint>(N));
+}
+
+template <class Archive>
+inline R_xlen_t unjam_list_length(Archive& bin, const Head& head) {
+  if (head.longbit()) {
+    ulong N;
+    bin(N);
+    return static_cast<R_xlen_t>(N);
+  }
+  uint N;
+  bin(N);
+  return N;
+}
+
+// Seek past an object whose head has been read (info.cpp)
+void skip_sexp(JamIArchive& bin, const Head& head);
+
+// Number object `x` for later REF records. Objects which were skipped are
+// numbered with R_UnboundValue. NULLs are never numbered.
+inline void unjam_number(JamIArchive& bin, SEXP x) {
+  if (bin.refs == R_NilValue)
+    return;
+  if (bin.nrefs == XLENGTH(bin.refs))
+    REPROTECT(bin.refs = Rf_xlengthgets(bin.refs, 2 * bin.nrefs), bin.refs_index);
+  SET_VECTOR_ELT(bin.refs, bin.nrefs++, x);
+}
+
 // meta is a VECSEXP
 inline SEXP set_meta(SEXP obj, SEXP meta) {
   if (meta != R_NilValue) {
@@ -100,5 +192,12 @@ SEXP toSEXP(const std::vector<inT>& vec, SEXPTYPE stype) {
 template <>
 SEXP toSEXP(const std::vector<std::string>& vec, SEXPTYPE stype);
 
+// Conversion of decoded jar columns (unjar.cpp)
+SEXP VarColl2SEXP(const VarColl& vc);
+void set_col_attributes(SEXP col, const strmap<VarColl>& attr);
+SEXP columns_df(Reader& reader);
+SEXP empty_df(Reader& reader);
+bool init_filter(Reader& reader, List filter);
+
 
 #endif
@@ -0,0 +1,13 @@
+#include "rutils.hpp"
+
+// External merge sort of jar archives. Rows never pass through R.
+
+// [[Rcpp::export]]
+void c_jar_sort(const std::string& path, const std::string& out, std::vector<int> by,
+                double memory, const std::string& tmp_prefix, int rows_per_chunk) {
+  vector<size_t> cols(by.begin(), by.end());
+  Sorter sorter(path, out, cols, static_cast<size_t>(memory), tmp_prefix,
+                rows_per_chunk > 0 ? rows_per_chunk : 0);
+  sorter.run();
+  last_stats = sorter.stats;
+}
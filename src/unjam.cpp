@@ -1,26 +1,86 @@
 #include "rutils.hpp"
 
-SEXP unjam_sexp(cereal::BinaryInputArchive& bin);
-SEXP unjam_sexp(cereal::BinaryInputArchive& bin, const Head& head);
+SEXP unjam_sexp(JamIArchive& bin);
+SEXP unjam_sexp(JamIArchive& bin, const Head& head);
 
-SEXP unjam_bool_vec_tail(cereal::BinaryInputArchive& bin) {
+// Skip padding before data buffers of aligned vectors
+void unjam_padding(JamIArchive& bin) {
+  if (bin.aligned) {
+    ubyte npad;
+    bin(npad);
+    char pad[JAM_ALIGNMENT];
+    if (npad >= JAM_ALIGNMENT || bin.stream.rdbuf()->sgetn(pad, npad) != npad)
+      stop("Invalid padding of aligned vector.");
+  }
+}
+
+inline void unjam_skip(JamIArchive& bin, ulong nbytes) {
+  if (nbytes > 0)
+    bin.stream.rdbuf()->pubseekoff(nbytes, std::ios::cur, std::ios::in);
+}
+
+// Read a cereal vector of at most `limit` elements and seek past the rest
+template<class T>
+void unjam_buffer(JamIArchive& bin, std::vector<T>& vec, ulong limit) {
+  if (limit == MAX_ULONG) {
+    bin(vec);
+    return;
+  }
+  cereal::size_type n;
+  bin(cereal::make_size_tag(n));
+  vec.resize(std::min<ulong>(n, limit));
+  bin(cereal::binary_data(vec.data(), vec.size() * sizeof(T)));
+  unjam_skip(bin, (n - vec.size()) * sizeof(T));
+}
+
+template<>
+void unjam_buffer(JamIArchive& bin, std::vector<std::string>& vec, ulong limit) {
+  if (limit == MAX_ULONG) {
+    bin(vec);
+    return;
+  }
+  cereal::size_type n;
+  bin(cereal::make_size_tag(n));
+  vec.resize(std::min<ulong>(n, limit));
+  for (auto& str : vec)
+    bin(str);
+  for (ulong i = vec.size(); i < n; i++) {
+    cereal::size_type len;
+    bin(cereal::make_size_tag(len));
+    unjam_skip(bin, len);
+  }
+}
+
+SEXP unjam_bool_vec_tail(JamIArchive& bin) {
   PRINT("unjam_bool_vec_tail\n");
   std::vector<ubyte> bytes;
-  bin(bytes);
+  {
+    StatsTimer timer(bin.stats.io_time);
+    unjam_padding(bin);
+    // two elements per byte
+    unjam_buffer(bin, bytes, bin.limit == MAX_ULONG ? MAX_ULONG : bin.limit/2 + 1);
+  }
   size_t n = bytes.size();
-  size_t N = ((bytes[n-1] & 12) == 12) ? n*2 - 1 : n*2; // last 2 bits = 11, means no value
-  SEXP out = PROTECT(Rf_allocVector(LGLSXP, N));
+  size_t N = (n > 0 && (bytes[n-1] & 12) == 12) ? n*2 - 1 : n*2; // last 2 bits = 11, means no value
+  N = std::min<ulong>(N, bin.limit);
+  bin.stats.add(BOOL, N, sizeof(cereal::size_type) + n);
+  SEXP out;
+  {
+    StatsTimer timer(bin.stats.alloc_time);
+    out = PROTECT(Rf_allocVector(LGLSXP, N));
+  }
+  StatsTimer timer(bin.stats.encode_time);
   int* pt = LOGICAL(out);
   for (size_t i = 0; i < N; i++) {
-    std::div_t div = std::div(i, 2);
-    if (div.rem) {
+    ubyte b = bytes[i >> 1];
+    if (i & 1) {
       // lower bits
-      if (bytes[div.quot] & 8) pt[i] = NA_INTEGER;
-      else pt[i] = (bytes[div.quot] & 12) != 0;
+      if (b & 8) pt[i] = NA_INTEGER;
+      else pt[i] = (b & 12) != 0;
     } else {
       // upper bits
-      if (bytes[div.quot] & 2) pt[i] = NA_INTEGER;
-      else pt[i] = (bytes[div.quot] & 3) != 0;
+      if (b & 2) pt[i] = NA_INTEGER;
+      else pt[i] = (b & 3) != 0;
     }
   }
   UNPROTECT(1);
@@ -28,19 +88,35 @@ SEXP unjam_bool_vec_tail(cereal::BinaryInputArchive& bin) {
 }
 
 template <class inT>
-SEXP unjam_vec_tail(cereal::BinaryInputArchive& bin, SEXPTYPE stype){
+SEXP unjam_vec_tail(JamIArchive& bin, SEXPTYPE stype, Type jtype){
   PRINT("unjam_int_vec_tail\n");
   std::vector<inT> vec;
-  bin(vec);
+  {
+    StatsTimer timer(bin.stats.io_time);
+    unjam_padding(bin);
+    unjam_buffer(bin, vec, bin.limit);
+  }
+  bin.stats.add(jtype, vec.size(), sizeof(cereal::size_type) + vec.size() * sizeof(inT));
+  StatsTimer timer(bin.stats.alloc_time);
   return toSEXP<inT>(vec, stype);
 }
 
 template <class inT>
-SEXP unjam_int_vec_tail(cereal::BinaryInputArchive& bin, SEXPTYPE stype, const inT& na_val){
+SEXP unjam_int_vec_tail(JamIArchive& bin, SEXPTYPE stype, Type jtype, const inT& na_val){
   PRINT("unjam_int_vec_tail\n");
   std::vector<inT> vec;
-  bin(vec);
-  SEXP out = PROTECT(Rf_allocVector(INTSXP, vec.size()));
+  {
+    StatsTimer timer(bin.stats.io_time);
+    unjam_padding(bin);
+    unjam_buffer(bin, vec, bin.limit);
+  }
+  bin.stats.add(jtype, vec.size(), sizeof(cereal::size_type) + vec.size() * sizeof(inT));
+  SEXP out;
+  {
+    StatsTimer timer(bin.stats.alloc_time);
+    out = PROTECT(Rf_allocVector(INTSXP, vec.size()));
+  }
+  StatsTimer timer(bin.stats.encode_time);
   int* px = INTEGER(out);
   for (size_t i = 0; i < vec.size(); i++) {
     if (vec[i] == na_val)
@@ -52,19 +128,87 @@ SEXP unjam_int_vec_tail(cereal::BinaryInputArchive& bin, SEXPTYPE stype, const i
   return out;
 }
 
+// integer64 vector narrowed by jam to `inT`
+template <class inT>
+SEXP unjam_long_vec_tail(JamIArchive& bin, Type jtype, const inT& na_val){
+  PRINT("unjam_long_vec_tail\n");
+  std::vector<inT> vec;
+  {
+    StatsTimer timer(bin.stats.io_time);
+    unjam_padding(bin);
+    unjam_buffer(bin, vec, bin.limit);
+  }
+  bin.stats.add(jtype, vec.size(), sizeof(cereal::size_type) + vec.size() * sizeof(inT));
+  SEXP out;
+  {
+    StatsTimer timer(bin.stats.alloc_time);
+    out = PROTECT(Rf_allocVector(REALSXP, vec.size()));
+  }
+  StatsTimer timer(bin.stats.encode_time);
+  int64_t* px = INTEGER64(out);
+  for (size_t i = 0; i < vec.size(); i++) {
+    if (vec[i] == na_val)
+      px[i] = NA_LONG;
+    else
+      px[i] = vec[i];
+  }
+  UNPROTECT(1);
+  return out;
+}
+
+SEXP unjam_long_vec(JamIArchive& bin, Type jtype) {
+  switch (jtype) {
+   case jam::BYTE:   return unjam_long_vec_tail<byte>(bin, BYTE, NA_BYTE);
+   case jam::UBYTE:  return unjam_long_vec_tail<ubyte>(bin, UBYTE, NA_UBYTE);
+   case jam::SHORT:  return unjam_long_vec_tail<short>(bin, SHORT, NA_SHORT);
+   case jam::USHORT: return unjam_long_vec_tail<ushort>(bin, USHORT, NA_USHORT);
+   case jam::INT:    return unjam_long_vec_tail<int>(bin, INT, NA_INT);
+   case jam::UINT:   return unjam_long_vec_tail<uint>(bin, UINT, NA_UINT);
+   case jam::LONG:   return unjam_long_vec_tail<int64_t>(bin, LONG, NA_LONG);
+   default:
+     stop("Invalid JamElType (%s) for integer64 vector.", jam::Type2String(jtype));
+  }
+}
+
+bool is_integer64_meta(SEXP meta) {
+  SEXP cls = get_list_elt(meta, "class");
+  if (TYPEOF(cls) != STRSXP)
+    return false;
+  for (R_xlen_t i = 0; i < XLENGTH(cls); i++)
+    if (strcmp(CHAR(STRING_ELT(cls, i)), "integer64") == 0)
+      return true;
+  return false;
+}
+
 template<class lenT>
-SEXP unjam_char_utf8_tail(cereal::BinaryInputArchive& bin) {
+SEXP unjam_char_utf8_tail(JamIArchive& bin) {
   PRINT("unjam_char_utf8_tail\n");
   
   std::vector<lenT> nchars;
-  bin(nchars);
   std::vector<uint8_t> data;
-  bin(data);
+  {
+    StatsTimer timer(bin.stats.io_time);
+    unjam_padding(bin);
+    unjam_buffer(bin, nchars, bin.limit);
+    unjam_padding(bin);
+    if (bin.limit == MAX_ULONG) {
+      bin(data);
+    } else {
+      // only the characters of the first nchars.size() strings
+      ulong len = 0;
+      for (lenT n : nchars)
+        if (n > 0) len += n;
+      unjam_buffer(bin, data, len);
+    }
+  }
   const char* dpt = reinterpret_cast<const char*>(data.data());
   size_t N = nchars.size();
+  bin.stats.add(UTF8, N, 4 + 2*sizeof(cereal::size_type) + N * sizeof(lenT) + data.size());
   
+  // CHARSXP creation dominates; account all of it as allocation
+  StatsTimer timer(bin.stats.alloc_time);
   SEXP out = PROTECT(Rf_allocVector(STRSXP, N));
-  for (int i = 0; i < N; i++){
+  for (size_t i = 0; i < N; i++){
     lenT n = nchars[i];
     if (n == 0)
       SET_STRING_ELT(out, i, R_BlankString);
@@ -79,30 +223,39 @@ SEXP unjam_char_utf8_tail(cereal::BinaryInputArchive& bin) {
   return out;
 }
 
-SEXP unjam_list_tail(cereal::BinaryInputArchive& bin, const Head& head) {
+SEXP unjam_list_tail(JamIArchive& bin, const Head& head) {
 #ifdef DEBUG
   head.print("unjam_list_tail:");
 #endif
   
-  uint N;
-  bin(N);
+  R_xlen_t N = unjam_list_length(bin, head);
+  bin.stats.add(head.coll_type, N, head.longbit() ? sizeof(ulong) : sizeof(uint));
+  // elements beyond the limit are skipped
+  R_xlen_t M = std::min<ulong>(N, bin.limit);
   
-  SEXP out = PROTECT(Rf_allocVector(VECSXP, N));
+  SEXP out = PROTECT(Rf_allocVector(VECSXP, M));
 
   if (N > 0) {
     switch (head.el_type) {
      case jam::MIXED:
        {
-         for (int i = 0; i < N; ++i)
+         for (R_xlen_t i = 0; i < M; ++i)
            SET_VECTOR_ELT(out, i, unjam_sexp(bin));
+         for (R_xlen_t i = M; i < N; ++i) {
+           Head el_head;
+           bin(el_head);
+           skip_sexp(bin, el_head);
+         }
        }
        break;
      case jam::VECTOR:
        {
          Head common_head;
          bin(common_head);
-         for (int i = 0; i < N; ++i)
+         for (R_xlen_t i = 0; i < M; ++i)
            SET_VECTOR_ELT(out, i, unjam_sexp(bin, common_head));
+         for (R_xlen_t i = M; i < N; ++i)
+           skip_sexp(bin, common_head);
        }
        break;
      default:
@@ -114,11 +267,15 @@ SEXP unjam_list_tail(cereal::BinaryInputArchive& bin, const Head& head) {
   return out;
 }
 
-SEXP unjam_meta(cereal::BinaryInputArchive& bin) {
+SEXP unjam_meta(JamIArchive& bin) {
   PRINT(">META\n");
   std::vector<std::string> names;
   bin(names);
+  // attributes are read whole; see fit_attribute
+  ulong limit = bin.limit;
+  bin.limit = MAX_ULONG;
   SEXP out = PROTECT(unjam_list_tail(bin, JAM_META_HEAD));
+  bin.limit = limit;
   if (names.size() > 0) {
     Rf_setAttrib(out, R_NamesSymbol, toSEXP(names, STRSXP));
   }
@@ -127,7 +284,37 @@ SEXP unjam_meta(cereal::BinaryInputArchive& bin) {
   return out;
 }
 
-SEXP unjam_sexp(cereal::BinaryInputArchive& bin, const Head& head) {
+// Adjust attribute `name` to an object truncated to its first elements:
+// names and row names are truncated, dim and dimnames of truncated arrays
+// dropped (R_NilValue).
+SEXP fit_attribute(SEXP x, const char* name, SEXP val) {
+  R_xlen_t n = XLENGTH(x);
+  if (strcmp(name, "names") == 0) {
+    if (XLENGTH(val) > n)
+      return Rf_xlengthgets(val, n);
+  } else if (strcmp(name, "dim") == 0) {
+    double size = 1;
+    for (R_xlen_t i = 0; i < XLENGTH(val); i++)
+      size *= INTEGER(val)[i];
+    if (size != n)
+      return R_NilValue;
+  } else if (strcmp(name, "dimnames") == 0) {
+    if (Rf_getAttrib(x, R_DimSymbol) == R_NilValue)
+      return R_NilValue;
+  } else if (strcmp(name, "row.names") == 0 && TYPEOF(x) == VECSXP) {
+    R_xlen_t nrows = n > 0 ? XLENGTH(VECTOR_ELT(x, 0)) : 0;
+    if (TYPEOF(val) == INTSXP && XLENGTH(val) == 2 && INTEGER(val)[0] == NA_INTEGER) {
+      // compact row names c(NA, -nrows)
+      if (-INTEGER(val)[1] > nrows)
+        return IntegerVector::create(NA_INTEGER, -static_cast<int>(nrows));
+    } else if (XLENGTH(val) > nrows) {
+      return Rf_xlengthgets(val, nrows);
+    }
+  }
+  return val;
+}
+
+SEXP unjam_sexp(JamIArchive& bin, const Head& head) {
 #ifdef DEBUG
   head.print("unjam_sexp:");
 #endif
@@ -139,6 +326,8 @@ SEXP unjam_sexp(cereal::BinaryInputArchive& bin, const Head& head) {
     meta = PROTECT(unjam_meta(bin));
     nprot++;
   }
+  if (head.crcbit() && bin.crcbuf)
+    bin.crcbuf->reset();
   
   SEXP out; 
 
@@ -149,38 +338,59 @@ SEXP unjam_sexp(cereal::BinaryInputArchive& bin, const Head& head) {
      break;
 
    case jam::VECTOR:
-     switch (head.el_type) {
-      case jam::NIL:        stop("Invalid VECTOR specification. Elements of a vector cannot be nil.");
-      case jam::BOOL:       out = unjam_bool_vec_tail(bin); break;
-      case jam::BYTE:       out = unjam_int_vec_tail<byte>(bin, INTSXP, NA_BYTE); break;
-      case jam::UBYTE:      out = unjam_int_vec_tail<ubyte>(bin, INTSXP, NA_UBYTE); break;
-      case jam::SHORT:      out = unjam_int_vec_tail<short>(bin, INTSXP, NA_SHORT); break;
-      case jam::USHORT:     out = unjam_int_vec_tail<ushort>(bin, INTSXP, NA_USHORT); break;
-      case jam::INT:        out = unjam_vec_tail<int>(bin, INTSXP); break;
-      case jam::UINT:       out = unjam_int_vec_tail<uint>(bin, INTSXP, NA_UINT); break;
-
-      case jam::FLOAT:      out = unjam_vec_tail<float>(bin, REALSXP); break;
-      case jam::DOUBLE:     out = unjam_vec_tail<double>(bin, REALSXP); break;
-
-      case jam::STRING:     out = unjam_vec_tail<std::string>(bin, STRSXP); break;
-
-      case jam::UTF8:
-        {
-          Head nchar_head;
-          bin(nchar_head);
-          switch (nchar_head.el_type) {
-           case jam::BYTE:  out = unjam_char_utf8_tail<byte>(bin); break;
-           case jam::SHORT: out = unjam_char_utf8_tail<short>(bin); break;
-           case jam::INT:   out = unjam_char_utf8_tail<int>(bin); break;
-           default:
-             stop("Invalid JamElType (%s) for nchar specification.",
-                  jam::Type2String(nchar_head.el_type));
-          }
-        };
-        break;
-      default:
-        stop("Unsupported JamElType in the header (%s).", jam::Type2String(head.el_type));
-     }  
+     bin.aligned = head.aligned();
+     // integer64 vectors are narrowed by jam to the smallest integer type
+     if (head.el_type == LONG || (Jam2SexpType(head.el_type) == INTSXP && is_integer64_meta(meta))) {
+       out = unjam_long_vec(bin, head.el_type);
+       if (meta == R_NilValue) {
+         PROTECT(out);
+         Rf_setAttrib(out, R_ClassSymbol, Rf_mkString("integer64"));
+         UNPROTECT(1);
+       }
+     } else {
+       switch (head.el_type) {
+        case jam::NIL:        stop("Invalid VECTOR specification. Elements of a vector cannot be nil.");
+        case jam::BOOL:       out = unjam_bool_vec_tail(bin); break;
+        case jam::BYTE:       out = unjam_int_vec_tail<byte>(bin, INTSXP, BYTE, NA_BYTE); break;
+        case jam::UBYTE:      out = unjam_int_vec_tail<ubyte>(bin, INTSXP, UBYTE, NA_UBYTE); break;
+        case jam::SHORT:      out = unjam_int_vec_tail<short>(bin, INTSXP, SHORT, NA_SHORT); break;
+        case jam::USHORT:     out = unjam_int_vec_tail<ushort>(bin, INTSXP, USHORT, NA_USHORT); break;
+        case jam::INT:        out = unjam_vec_tail<int>(bin, INTSXP, INT); break;
+        case jam::UINT:       out = unjam_int_vec_tail<uint>(bin, INTSXP, UINT, NA_UINT); break;
+
+        case jam::FLOAT:      out = unjam_vec_tail<float>(bin, REALSXP, FLOAT); break;
+        case jam::DOUBLE:     out = unjam_vec_tail<double>(bin, REALSXP, DOUBLE); break;
+
+        case jam::STRING:     out = unjam_vec_tail<std::string>(bin, STRSXP, STRING); break;
+
+        case jam::UTF8:
+          {
+            Head nchar_head;
+            bin(nchar_head);
+            switch (nchar_head.el_type) {
+             case jam::BYTE:  out = unjam_char_utf8_tail<byte>(bin); break;
+             case jam::SHORT: out = unjam_char_utf8_tail<short>(bin); break;
+             case jam::INT:   out = unjam_char_utf8_tail<int>(bin); break;
+             default:
+               stop("Invalid JamElType (%s) for nchar specification.",
+                    jam::Type2String(nchar_head.el_type));
+            }
+          };
+          break;
+        default:
+          stop("Unsupported JamElType in the header (%s).", jam::Type2String(head.el_type));
+       }
+     }
+     if (head.crcbit()) {
+       PROTECT(out);
+       uint computed = bin.crcbuf ? bin.crcbuf->crc() : 0;
+       uint crc;
+       bin(crc);
+       if (bin.crcbuf && crc != computed)
+         stop("Checksum mismatch in %s vector of length %.0f.",
+              jam::Type2String(head.el_type), (double) XLENGTH(out));
+       UNPROTECT(1);
+     }
      break;
 
    case jam::META:
@@ -194,27 +404,63 @@ SEXP unjam_sexp(cereal::BinaryInputArchive& bin, const Head& head) {
 
   PROTECT(out);
   nprot++;
+  bin.stats.objects++;
 
   if (meta != R_NilValue) {
     SEXP meta_names = Rf_getAttrib(meta, R_NamesSymbol);
     int metaN = LENGTH(meta_names);
     for (int i = 0; i < metaN; i++) {
-      Rf_setAttrib(out, Rf_installChar(STRING_ELT(meta_names, i)), VECTOR_ELT(meta, i));
+      SEXP val = VECTOR_ELT(meta, i);
+      if (bin.limit != MAX_ULONG) {
+        val = fit_attribute(out, CHAR(STRING_ELT(meta_names, i)), val);
+        if (val == R_NilValue)
+          continue;
+      }
+      PROTECT(val);
+      Rf_setAttrib(out, Rf_installChar(STRING_ELT(meta_names, i)), val);
+      UNPROTECT(1);
     }
   }
+
+  if (head.coll_type != jam::NIL)
+    unjam_number(bin, out);
   
   UNPROTECT(nprot);
   return out;
 }
 
-SEXP unjam_sexp(cereal::BinaryInputArchive& bin) {
+SEXP unjam_ref(JamIArchive& bin) {
+  ulong id;
+  bin(id);
+  if (bin.refs == R_NilValue || id >= static_cast<ulong>(bin.nrefs))
+    stop("Invalid reference in archive.");
+  SEXP out = VECTOR_ELT(bin.refs, id);
+  if (out == R_UnboundValue)
+    stop("Shared object was skipped; cannot read this archive with 'n'.");
+  return out;
+}
+
+SEXP unjam_sexp(JamIArchive& bin) {
   Head head; bin(head);
+  if (head.coll_type == jam::REF)
+    return unjam_ref(bin);
   return unjam_sexp(bin, head);
 }
 
 // [[Rcpp::export]]
-SEXP c_unjam(const std::string& path) {
+SEXP c_unjam(const std::string& path, bool verify, double n = -1) {
   std::ifstream fin(path, std::ios::binary);
-  cereal::BinaryInputArchive bin(fin);
-  return unjam_sexp(bin);
+  CrcIStreambuf crcbuf(fin.rdbuf());
+  std::istream in(&crcbuf);
+  JamIArchive bin(verify ? in : fin, verify ? &crcbuf : nullptr);
+  if (n >= 0)
+    bin.limit = static_cast<ulong>(n);
+  Head head;
+  bin(head);
+  PROTECT_WITH_INDEX(bin.refs = head.refbit() ? Rf_allocVector(VECSXP, 64) : R_NilValue,
+                     &bin.refs_index);
+  SEXP out = PROTECT(unjam_sexp(bin, head));
+  last_stats = bin.stats;
+  UNPROTECT(2);
+  return out;
 }
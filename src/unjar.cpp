@@ -1,5 +1,8 @@
 #include "rutils.hpp"
 #include <cstring>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 #include "jam.hpp"
 using namespace jam;
@@ -17,12 +20,60 @@ int unjar_int_primitive(cereal::BinaryInputArchive& bin, const Tin& na_val) {
   else return static_cast<int>(el);
 }
 
+// 64-bit integers are returned as bit64::integer64 bit patterns; the class
+// comes with the column attributes
+SEXP long_vec2SEXP(const long_vec& x) {
+  SEXP out = Rf_allocVector(REALSXP, x.size());
+  std::copy(x.begin(), x.end(), INTEGER64(out));
+  return out;
+}
+
+// Row of a LIST, elements [first, last) of its flat values. Element
+// attributes are not stored except for the class of integer64 elements.
+SEXP list_row2SEXP(const VarColl& vc, size_t first, size_t last) {
+  size_t n = last - first;
+  SEXP out;
+  switch (vc.el_type) {
+   case INT:
+     out = Rf_allocVector(INTSXP, n);
+     std::copy(vc.int_vec_val.begin() + first, vc.int_vec_val.begin() + last, INTEGER(out));
+     return out;
+   case LONG:
+     out = PROTECT(Rf_allocVector(REALSXP, n));
+     std::copy(vc.long_vec_val.begin() + first, vc.long_vec_val.begin() + last, INTEGER64(out));
+     Rf_setAttrib(out, R_ClassSymbol, Rf_mkString("integer64"));
+     UNPROTECT(1);
+     return out;
+   case DOUBLE:
+     out = Rf_allocVector(REALSXP, n);
+     std::copy(vc.dbl_vec_val.begin() + first, vc.dbl_vec_val.begin() + last, REAL(out));
+     return out;
+   case STRING:
+     out = PROTECT(Rf_allocVector(STRSXP, n));
+     for (size_t i = 0; i < n; i++) {
+       const string& s = vc.str_vec_val[first + i];
+       SET_STRING_ELT(out, i, Rf_mkCharLenCE(s.c_str(), s.size(), CE_UTF8));
+     }
+     UNPROTECT(1);
+     return out;
+   default:
+     stop("Unsuported el type %s in LIST.", Type2String(vc.el_type));
+  }
+}
+
+// Fill rows [offset, offset + vc.size()) of list column `out`
+void fill_list_column(SEXP out, const VarColl& vc, size_t offset) {
+  for (size_t i = 0; i < vc.size(); i++)
+    SET_VECTOR_ELT(out, offset + i, list_row2SEXP(vc, vc.offsets[i], vc.offsets[i + 1]));
+}
+
 SEXP VarColl2SEXP (const VarColl& vc) {
   PRINT("ct:%s  et:%s\n", Type2String(vc.coll_type).c_str(), Type2String(vc.el_type).c_str());
   switch(vc.coll_type) {
    case VECTOR:
      switch (vc.el_type) {
       case INT:    return wrap(vc.int_vec_val);
+      case LONG:   return long_vec2SEXP(vc.long_vec_val);
       case DOUBLE: return wrap(vc.dbl_vec_val);
       case STRING: return wrap(vc.str_vec_val);
       default:
@@ -38,18 +89,50 @@ SEXP VarColl2SEXP (const VarColl& vc) {
         stop("Unsuported el type %s in MAP.", Type2String(vc.el_type));
      }
      break;
+   case LIST: {
+     SEXP out = PROTECT(Rf_allocVector(VECSXP, vc.size()));
+     fill_list_column(out, vc, 0);
+     UNPROTECT(1);
+     return out;
+   }
    case NIL: return R_NilValue;
    default:
      stop("Unsuported coll type %s", Type2String(vc.coll_type));
   }
 }
 
-SEXP unjar_sexp(Reader& reader, int chunks) {
+void set_col_attributes(SEXP col, const strmap<VarColl>& attr) {
+  if (attr.size() > 0) {
+    PRINT("setting attributes\n");
+    for (const auto& kv : attr) {
+      SEXP nm = Rf_installChar(Rf_mkChar(kv.first.c_str()));
+      Rf_setAttrib(col, nm, VarColl2SEXP(kv.second));
+    }
+  }
+}
 
-  PRINT("-- fetch columns --\n");
-  vector<VarColl>& cols = reader.read_columns(chunks);
-  PRINT("-- done --\n");
+SEXP set_df_attributes(List& out, const Reader& reader, size_t nrows) {
+  for (const auto& kv : reader.meta) {
+    if (kv.first != "row.names")
+      out.attr(kv.first) = VarColl2SEXP(kv.second);
+  }
+  out.attr("row.names") = IntegerVector::create(NA_INTEGER, -nrows);
+  return out;
+}
+
+void warn_corrupted(const vector<size_t>& corrupted) {
+  if (corrupted.size() == 0)
+    return;
+  string ids;
+  for (size_t i = 0; i < corrupted.size(); i++)
+    ids += (i > 0 ? ", " : "") + std::to_string(corrupted[i] + 1);
+  warning("Skipped %d corrupted chunk(s): %s", (int) corrupted.size(), ids.c_str());
+}
+
+// Data frame of the columns last read by `reader`
+SEXP columns_df(Reader& reader) {
 
+  vector<VarColl>& cols = reader.columns;
   if (cols.size() == 0)
     return R_NilValue;
 
@@ -59,53 +142,331 @@ SEXP unjar_sexp(Reader& reader, int chunks) {
   // BUILD OUTPUT LIST
   List out(ncols);
 
+  StatsTimer timer(reader.stats.alloc_time);
   for (size_t c = 0; c < ncols; c++) {
     PRINT("assigning column %ld\n", c);
     SEXP col = PROTECT(VarColl2SEXP(cols[c]));
-    strmap<VarColl> attr = reader.col_metas[c];
-    if (attr.size() > 0) {
-      PRINT("setting attributes\n");
-      for (const auto& kv : attr) {
-        SEXP nm = Rf_installChar(Rf_mkChar(kv.first.c_str()));
-        Rf_setAttrib(col, nm, VarColl2SEXP(kv.second));
-      }
-    }
+    set_col_attributes(col, reader.col_metas[c]);
     out[c] = col;
     UNPROTECT(1);
   }
 
-  // SET ATTRIBUTES
-  for (const auto& kv : reader.meta) {
-    if (kv.first != "row.names")
-      out.attr(kv.first) = VarColl2SEXP(kv.second);
+  return set_df_attributes(out, reader, nrows);
+}
+
+SEXP unjar_sexp(Reader& reader, int chunks) {
+  PRINT("-- fetch columns --\n");
+  reader.read_columns(chunks);
+  PRINT("-- done --\n");
+  return columns_df(reader);
+}
+
+// Decode chunks concurrently. Each worker reads chunks through its own file
+// handle and copies numeric data straight into its row range of the
+// preallocated output columns. Strings and list columns are decoded by the
+// workers but CHARSXPs and row vectors can only be created on the R thread.
+SEXP unjar_sexp_parallel(Reader& reader, int chunks, int threads, bool verify, bool skip_corrupted) {
+
+  const Index& index = reader.fetch_index();
+  // positions of chunks to read (all unless filtering)
+  vector<size_t> ids = reader.selected_chunks();
+  if (chunks > 0 && ids.size() > (size_t) chunks)
+    ids.resize(chunks);
+  size_t nchunks = ids.size();
+  if (nchunks == 0)
+    return R_NilValue;
+
+  if (reader.ncols() == 0)
+    reader.fetch_header();
+
+  vector<size_t> row_offsets(nchunks + 1, 0);
+  for (size_t i = 0; i < nchunks; i++) {
+    if (i > 0 && !index.chunks[ids[i]].continuation)
+      stop("Heterogeneous chunks cannot be bound at the moment. Try non binding option instead.");
+    row_offsets[i + 1] = row_offsets[i] + index.chunks[ids[i]].nrows;
   }
-  out.attr("row.names") = IntegerVector::create(NA_INTEGER, -nrows);
-  
-  return out;
+
+  const vector<Type>& types = index.col_types;
+  size_t ncols = types.size();
+  size_t nrows = row_offsets[nchunks];
+
+  StatsTimer alloc_timer(reader.stats.alloc_time);
+  List out(ncols);
+  vector<int*> int_ptrs(ncols, nullptr);
+  vector<double*> dbl_ptrs(ncols, nullptr);
+  bool has_lists = false;
+  for (size_t c = 0; c < ncols; c++) {
+    if (index.coll_type(c) == LIST) {
+      out[c] = Rf_allocVector(VECSXP, nrows);
+      has_lists = true;
+      continue;
+    }
+    switch (types[c]) {
+     case INT:
+       out[c] = Rf_allocVector(INTSXP, nrows);
+       int_ptrs[c] = INTEGER(out[c]);
+       break;
+     case LONG:
+     case DOUBLE:
+       out[c] = Rf_allocVector(REALSXP, nrows);
+       dbl_ptrs[c] = REAL(out[c]);
+       break;
+     case STRING:
+       out[c] = Rf_allocVector(STRSXP, nrows);
+       break;
+     default:
+       stop("Unsuported el type %s in VECTOR.", Type2String(types[c]));
+    }
+  }
+
+  vector<vector<str_vec>> strings(nchunks, vector<str_vec>(ncols));
+  vector<vector<VarColl>> lists(nchunks, vector<VarColl>(has_lists ? ncols : 0));
+  vector<char> corrupted(nchunks, 0);
+  std::atomic<size_t> next_chunk(0);
+  std::atomic<bool> failed(false);
+  std::mutex error_mutex;
+  string error;
+
+  auto worker = [&]() {
+    std::ifstream in(reader.path, std::ios::binary);
+    vector<VarColl> cols;
+    Stats stats;
+    size_t i;
+    while (!failed && (i = next_chunk++) < nchunks) {
+      const ChunkInfo& info = index.chunks[ids[i]];
+      try {
+        try {
+          StatsTimer timer(stats.io_time);
+          read_chunk_payload(in, info, cols, verify);
+        } catch (ChecksumException&) {
+          if (!skip_corrupted)
+            throw;
+          corrupted[i] = 1;
+          continue;
+        }
+        stats.objects++;
+        if (cols.size() != ncols)
+          throw JamException("Chunk " + std::to_string(ids[i]) + " has wrong number of columns");
+        size_t offset = row_offsets[i];
+        for (size_t c = 0; c < ncols; c++) {
+          VarColl& col = cols[c];
+          if (col.el_type != types[c] || col.coll_type != index.coll_type(c))
+            throw JamException("Column " + std::to_string(c) + " type (" + Type2String(col.el_type) +
+                               ") doesn't match old type (" + Type2String(types[c]) + ")");
+          if (col.size() != info.nrows)
+            throw JamException("Chunk " + std::to_string(ids[i]) + " doesn't match its index entry");
+          stats.add(col.el_type, col.size(), col.nbytes());
+          if (col.coll_type == LIST) {
+            lists[i][c] = std::move(col);
+            continue;
+          }
+          switch (col.el_type) {
+           case INT:
+             std::copy(col.int_vec_val.begin(), col.int_vec_val.end(), int_ptrs[c] + offset);
+             break;
+           case LONG:
+             std::copy(col.long_vec_val.begin(), col.long_vec_val.end(), reinterpret_cast<int64_t*>(dbl_ptrs[c]) + offset);
+             break;
+           case DOUBLE:
+             std::copy(col.dbl_vec_val.begin(), col.dbl_vec_val.end(), dbl_ptrs[c] + offset);
+             break;
+           case STRING:
+             strings[i][c] = std::move(col.str_vec_val);
+             break;
+           default: break;
+          }
+        }
+      } catch (std::exception& e) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!failed) error = e.what();
+        failed = true;
+      }
+    }
+    std::lock_guard<std::mutex> lock(error_mutex);
+    reader.stats.merge(stats);
+  };
+
+  vector<std::thread> pool;
+  for (int t = 1; t < threads; t++)
+    pool.emplace_back(worker);
+  worker();
+  for (auto& th : pool)
+    th.join();
+
+  if (failed)
+    stop(error);
+
+  // Drop rows of corrupted chunks by moving subsequent chunks down. Numeric
+  // data moves towards lower addresses, so copying in chunk order is safe.
+  vector<size_t> dropped;
+  for (size_t i = 0; i < nchunks; i++)
+    if (corrupted[i]) dropped.push_back(ids[i]);
+  if (dropped.size() > 0) {
+    vector<size_t> kept_offsets(nchunks + 1, 0);
+    for (size_t i = 0; i < nchunks; i++) {
+      size_t n = corrupted[i] ? 0 : index.chunks[ids[i]].nrows;
+      kept_offsets[i + 1] = kept_offsets[i] + n;
+      if (n == 0 || kept_offsets[i] == row_offsets[i]) continue;
+      for (size_t c = 0; c < ncols; c++) {
+        if (int_ptrs[c])
+          std::copy(int_ptrs[c] + row_offsets[i], int_ptrs[c] + row_offsets[i] + n, int_ptrs[c] + kept_offsets[i]);
+        else if (dbl_ptrs[c])
+          std::copy(dbl_ptrs[c] + row_offsets[i], dbl_ptrs[c] + row_offsets[i] + n, dbl_ptrs[c] + kept_offsets[i]);
+      }
+    }
+    row_offsets = kept_offsets;
+    nrows = row_offsets[nchunks];
+    for (size_t c = 0; c < ncols; c++)
+      out[c] = Rf_xlengthgets(out[c], nrows);
+    warn_corrupted(dropped);
+  }
+
+  for (size_t c = 0; c < ncols; c++) {
+    if (index.coll_type(c) == LIST) {
+      for (size_t i = 0; i < nchunks; i++) {
+        if (corrupted[i]) continue;
+        fill_list_column(out[c], lists[i][c], row_offsets[i]);
+        lists[i][c] = VarColl();
+      }
+    } else if (types[c] == STRING) {
+      SEXP col = out[c];
+      for (size_t i = 0; i < nchunks; i++) {
+        const str_vec& vec = strings[i][c];
+        size_t offset = row_offsets[i];
+        for (size_t r = 0; r < vec.size(); r++)
+          SET_STRING_ELT(col, offset + r, Rf_mkCharLenCE(vec[r].c_str(), vec[r].size(), CE_UTF8));
+        str_vec().swap(strings[i][c]);
+      }
+    }
+    set_col_attributes(out[c], reader.col_metas[c]);
+  }
+
+  return set_df_attributes(out, reader, nrows);
+}
+
+void init_verify(Reader& reader, bool verify, bool skip_corrupted) {
+  if (verify && !reader.verify(skip_corrupted))
+    warning("Archive '%s' has no checksums; reading without verification.", reader.path.c_str());
+}
+
+// Convert filter conditions prepared in R, list(col = <0-based index>, op =
+// <string>, value = <numeric or character>), into zone map conditions.
+// Conditions which cannot be checked against zone maps are dropped. Return
+// false if the archive has no zone maps.
+bool init_filter(Reader& reader, List filter) {
+  if (filter.size() == 0)
+    return false;
+  const vector<Type>& types = reader.fetch_index().col_types;
+  vector<Condition> conditions;
+  for (R_xlen_t i = 0; i < filter.size(); i++) {
+    List el = as<List>(filter[i]);
+    size_t col = as<int>(el["col"]);
+    string op = as<string>(el["op"]);
+    SEXP value = el["value"];
+    // list columns have no zone maps
+    if (col >= types.size() || XLENGTH(value) == 0 || reader.fetch_index().coll_type(col) != VECTOR)
+      continue;
+    Condition cond;
+    cond.col = col;
+    cond.is_string = TYPEOF(value) == STRSXP;
+    if (cond.is_string != (types[col] == STRING))
+      continue;
+    if (op == "%in%") {
+      cond.op = Condition::IN;
+      if (cond.is_string)
+        cond.svalues = as<str_vec>(value);
+      else
+        cond.values = as<dbl_vec>(value);
+      conditions.push_back(cond);
+      continue;
+    }
+    if (op == "<") cond.op = Condition::LT;
+    else if (op == "<=") cond.op = Condition::LE;
+    else if (op == ">") cond.op = Condition::GT;
+    else if (op == ">=") cond.op = Condition::GE;
+    else if (op == "==") cond.op = Condition::EQ;
+    else stop("Invalid filter operator '%s'", op.c_str());
+    if (cond.is_string)
+      cond.svalue = as<string>(value);
+    else
+      cond.value = as<double>(value);
+    conditions.push_back(cond);
+  }
+  return reader.filter(conditions);
+}
+
+// Zero-row data.frame with the columns of the archive
+SEXP empty_df(Reader& reader) {
+  const vector<Type>& types = reader.fetch_index().col_types;
+  if (reader.ncols() == 0)
+    reader.fetch_header();
+  List out(types.size());
+  for (size_t c = 0; c < types.size(); c++) {
+    SEXPTYPE type = reader.fetch_index().coll_type(c) == LIST ? VECSXP : Jam2SexpType(types[c]);
+    out[c] = Rf_allocVector(type, 0);
+    set_col_attributes(out[c], reader.col_metas[c]);
+  }
+  return set_df_attributes(out, reader, 0);
 }
 
 // [[Rcpp::export]]
-SEXP c_unjar_bind(const std::string& path, int chunks) {
+SEXP c_unjar_bind(const std::string& path, int chunks, int prefetch, int threads,
+                  bool verify, bool skip_corrupted, List filter) {
   Reader reader(path);
-  return unjar_sexp(reader, chunks);
+  init_verify(reader, verify, skip_corrupted);
+  bool filtering = init_filter(reader, filter);
+  SEXP out;
+  if (threads > 1) {
+    out = unjar_sexp_parallel(reader, chunks, threads, verify && reader.fetch_index().has_crc, skip_corrupted);
+  } else {
+    if (prefetch > 0)
+      reader.prefetch(prefetch);
+    out = unjar_sexp(reader, chunks);
+    warn_corrupted(reader.corrupted_chunks());
+  }
+  if (filtering && out == R_NilValue)
+    out = empty_df(reader);
+  last_stats = reader.stats;
+  return out;
 }
 
 // [[Rcpp::export]]
-SEXP c_unjar_nobind(const std::string& path, int chunks) {
+SEXP c_unjar_nobind(const std::string& path, int chunks, int prefetch,
+                    bool verify, bool skip_corrupted, List filter) {
   Reader reader(path);
+  init_verify(reader, verify, skip_corrupted);
+  init_filter(reader, filter);
+  if (prefetch > 0)
+    reader.prefetch(prefetch);
 
   if (chunks <= 0)
     chunks = MAX_INT;
       
   List out;
 
-  SEXP df = unjar_sexp(reader, 1);
-  size_t nchunk = 1;
-  while (df != R_NilValue && nchunk < chunks) {
+  size_t nchunk = 0;
+  while (nchunk < chunks) {
+    SEXP df = unjar_sexp(reader, 1);
+    if (df == R_NilValue)
+      break;
     out.push_back(df);
-    df = unjar_sexp(reader, 1);
     nchunk++;
   }
 
+  warn_corrupted(reader.corrupted_chunks());
+  last_stats = reader.stats;
   return out;  
 }
+
+// Rows at sorted 0-based positions `rows` (doubles, as rows may exceed
+// the int range)
+// [[Rcpp::export]]
+SEXP c_unjar_rows(const std::string& path, std::vector<double> rows) {
+  Reader reader(path);
+  reader.read_rows(vector<ulong>(rows.begin(), rows.end()));
+  SEXP out = columns_df(reader);
+  if (out == R_NilValue)
+    out = empty_df(reader);
+  last_stats = reader.stats;
+  return out;
+}